@@ -1,12 +1,20 @@
 #version 430 core
 
-layout(location=0) in float height;
-layout(location=1) in vec3 normal;
-layout(location=2) in float originalHeight;
-
 layout(location=0) uniform mat4 mvp;
 layout(location=1) uniform mat4 model;
 layout(location=2) uniform int size;
+layout(location=18) uniform vec2 origin; // world cell of the first vertex, non zero for streamed chunks
+layout(location=19) uniform int halo; // rows and columns of neighbouring heights stored around the grid
+layout(location=20) uniform vec2 heightRange; // heights and altitude are 16 bit unorm within this range
+
+// two 16 bit heights per element, the lower half first
+layout(std430, binding=8) readonly buffer Heights {
+    uint heights[];
+};
+
+layout(std430, binding=10) readonly buffer Altitudes {
+    uint altitudes[];
+};
 
 out VS_OUT {
     vec3 position;
@@ -15,13 +23,33 @@ out VS_OUT {
     mat3 normalMatrix;
 } vs_out;
 
+float decode(uint pair, int index) {
+    const uint packed = (pair >> ((index & 1) * 16)) & 0xFFFFu;
+    return mix(heightRange.x, heightRange.y, float(packed) / 65535.0);
+}
+
+float heightAt(int x, int z) {
+    // clamp to the stored heights, grids without a halo use one sided differences at their edges
+    x = clamp(x, -halo, size - 1 + halo);
+    z = clamp(z, -halo, size - 1 + halo);
+    const int index = (z + halo) * (size + 2 * halo) + x + halo;
+    return decode(heights[index >> 1], index);
+}
+
 void main(){
-    vec3 position = vec3(gl_VertexID % size, height, gl_VertexID / size);
+    // each instance is a triangle strip along one row of quads, alternating between its two rows
+    const int x = gl_VertexID >> 1;
+    const int z = gl_InstanceID + (gl_VertexID & 1);
+    vec3 position = vec3(origin.x + x, heightAt(x, z), origin.y + z);
+
+    // central differences of the neighbouring heights
+    const vec3 normal = vec3(heightAt(x - 1, z) - heightAt(x + 1, z), 2.0, heightAt(x, z - 1) - heightAt(x, z + 1));
     
     vs_out.normalMatrix = transpose(inverse(mat3(model)));
     vs_out.normal = normalize(vs_out.normalMatrix * normalize(normal));
     vs_out.position = (vec4(position, 1.0) * model).xyz;
-    vs_out.originalHeight = originalHeight;
+    const int vertex = z * size + x;
+    vs_out.originalHeight = decode(altitudes[vertex >> 1], vertex);
 
     gl_Position = mvp * vec4(position, 1.0);
 }
\ No newline at end of file
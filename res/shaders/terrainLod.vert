@@ -0,0 +1,83 @@
+#version 430 core
+
+const int PATCH_SIZE = 32;
+
+layout(location=0) uniform mat4 mvp;
+layout(location=1) uniform mat4 model;
+layout(location=2) uniform int size;
+layout(location=3) uniform vec3 cameraPosition;
+layout(location=20) uniform vec2 heightRange; // heights and altitude are 16 bit unorm within this range
+
+// two 16 bit heights per element, the lower half first
+layout(std430, binding=8) readonly buffer Heights {
+    uint heights[];
+};
+
+layout(std430, binding=10) readonly buffer Altitudes {
+    uint altitudes[];
+};
+
+struct Node {
+    vec4 placement; // grid x, grid z, cells between vertices
+    vec4 morph; // distances morphing to the next level starts and ends, then the node's height bounds
+};
+
+layout(std430, binding=11) readonly buffer Nodes {
+    Node nodes[];
+};
+
+out VS_OUT {
+    vec3 position;
+    vec3 normal;
+    float originalHeight;
+    mat3 normalMatrix;
+} vs_out;
+
+float decode(uint pair, int index) {
+    const uint packed = (pair >> ((index & 1) * 16)) & 0xFFFFu;
+    return mix(heightRange.x, heightRange.y, float(packed) / 65535.0);
+}
+
+float heightAt(int x, int z) {
+    x = clamp(x, 0, size - 1);
+    z = clamp(z, 0, size - 1);
+    const int index = z * size + x;
+    return decode(heights[index >> 1], index);
+}
+
+float sampleHeight(vec2 position) {
+    // morphing vertices sit between grid points
+    const ivec2 cell = ivec2(floor(position));
+    const vec2 t = position - vec2(cell);
+    return mix(mix(heightAt(cell.x, cell.y), heightAt(cell.x + 1, cell.y), t.x),
+        mix(heightAt(cell.x, cell.y + 1), heightAt(cell.x + 1, cell.y + 1), t.x), t.y);
+}
+
+void main(){
+    const Node node = nodes[gl_InstanceID];
+    const float step = node.placement.z;
+    vec2 grid = vec2(gl_VertexID % (PATCH_SIZE + 1), gl_VertexID / (PATCH_SIZE + 1));
+
+    // odd vertices slide on to their even neighbours as the camera moves away, matching the next level at the end of the range
+    const vec2 unmorphed = min(node.placement.xy + grid * step, vec2(size - 1));
+    const vec3 worldUnmorphed = (model * vec4(unmorphed.x, heightAt(int(unmorphed.x), int(unmorphed.y)), unmorphed.y, 1.0)).xyz;
+    const float morph = clamp((distance(worldUnmorphed, cameraPosition) - node.morph.x) / (node.morph.y - node.morph.x), 0.0, 1.0);
+    grid -= fract(grid * 0.5) * 2.0 * morph;
+
+    const vec2 cell = min(node.placement.xy + grid * step, vec2(size - 1));
+    const vec3 position = vec3(cell.x, sampleHeight(cell), cell.y);
+
+    // central differences spanning the node's vertex spacing
+    const int x = int(round(cell.x));
+    const int z = int(round(cell.y));
+    const int s = int(step);
+    const vec3 normal = vec3(heightAt(x - s, z) - heightAt(x + s, z), 2.0 * step, heightAt(x, z - s) - heightAt(x, z + s));
+
+    vs_out.normalMatrix = transpose(inverse(mat3(model)));
+    vs_out.normal = normalize(vs_out.normalMatrix * normalize(normal));
+    vs_out.position = (vec4(position, 1.0) * model).xyz;
+    const int vertex = clamp(z, 0, size - 1) * size + clamp(x, 0, size - 1);
+    vs_out.originalHeight = decode(altitudes[vertex >> 1], vertex);
+
+    gl_Position = mvp * vec4(position, 1.0);
+}
\ No newline at end of file
@@ -6,13 +6,20 @@ layout(location=5) uniform vec3 lightColour;
 layout(location=6) uniform vec2 fogDistances;
 layout(location=7) uniform vec3 fogColour;
 layout(location=8) uniform float maxHeight;
+layout(location=9) uniform vec2 terrainHeightRange; // terrain heights are 16 bit unorm within this range
+layout(location=12) uniform int terrainSize;
+
+// two 16 bit terrain heights per element, the lower half first
+layout(std430, binding=9) readonly buffer TerrainHeights {
+    uint terrainHeights[];
+};
 
 uniform samplerCube skybox;
 
 in VS_OUT {
     vec3 position;
     vec3 normal;
-    float terrainHeight;
+    vec2 terrainCell;
 } fs_in;
 
 out vec4 fragColour;
@@ -46,12 +53,27 @@ float getFogAmount(){
 	return 1.0 - clamp(fogFactor, 0.0, 1.0);
 }
 
+float terrainHeightAt(int x, int z){
+	const int index = clamp(z, 0, terrainSize - 1) * terrainSize + clamp(x, 0, terrainSize - 1);
+	const uint packed = (terrainHeights[index >> 1] >> ((index & 1) * 16)) & 0xFFFFu;
+	return mix(terrainHeightRange.x, terrainHeightRange.y, float(packed) / 65535.0);
+}
+
+float sampleTerrainHeight(vec2 cell){
+	// the water grid is coarser than the terrain, so the depth is taken per fragment
+	const ivec2 corner = ivec2(floor(cell));
+	const vec2 t = cell - vec2(corner);
+	return mix(mix(terrainHeightAt(corner.x, corner.y), terrainHeightAt(corner.x + 1, corner.y), t.x),
+		mix(terrainHeightAt(corner.x, corner.y + 1), terrainHeightAt(corner.x + 1, corner.y + 1), t.x), t.y);
+}
+
 void main(){
-	if (abs(fs_in.position.y - fs_in.terrainHeight) < 0.01){
+	const float terrainHeight = sampleTerrainHeight(fs_in.terrainCell);
+	if (fs_in.position.y - terrainHeight < 0.01){
 		discard;
 	}
 
-	const float transparency = smoothstep(0.01, 0.2, fs_in.position.y - fs_in.terrainHeight) * 0.7;
+	const float transparency = smoothstep(0.01, 0.2, fs_in.position.y - terrainHeight) * 0.7;
 	vec3 incidence = normalize(fs_in.position - cameraPosition);
     vec3 reflectance = reflect(incidence, normalize(fs_in.normal));
 	const float fogAmount = getFogAmount() * max((1.0 - fs_in.position.y / maxHeight), 0.75);
@@ -1,25 +1,46 @@
 #version 430 core
 
-layout(location=0) in float height;
-layout(location=1) in vec3 normal;
-layout(location=2) in float terrainHeight;
-
 layout(location=0) uniform mat4 mvp;
 layout(location=1) uniform mat4 model;
-layout(location=2) uniform int size;
+layout(location=2) uniform int size; // water vertices along each side
+layout(location=10) uniform int tileSize;
+layout(location=11) uniform int cellScale; // terrain cells between water vertices
+layout(location=12) uniform int terrainSize;
+
+layout(std430, binding=8) readonly buffer Heights {
+    float heights[];
+};
+
+// tiles containing water, x in the low 16 bits and z in the high
+layout(std430, binding=14) readonly buffer WetTiles {
+    int wetTiles[];
+};
 
 out VS_OUT {
     vec3 position;
     vec3 normal;
-    float terrainHeight;
+    vec2 terrainCell; // position in terrain cells, for the terrain height under each fragment
 } vs_out;
 
+float heightAt(int x, int z) {
+    return heights[clamp(z, 0, size - 1) * size + clamp(x, 0, size - 1)];
+}
+
 void main(){
-    const vec3 position = vec3(gl_VertexID % size, height, gl_VertexID / size);
+    // each instance is a triangle strip along one row of quads of a wet tile, alternating between its two rows
+    // strips running past the edge of the grid collapse in to degenerate triangles
+    const int tile = wetTiles[gl_InstanceID / tileSize];
+    const int x = min((tile & 0xFFFF) * tileSize + (gl_VertexID >> 1), size - 1);
+    const int z = min((tile >> 16) * tileSize + gl_InstanceID % tileSize + (gl_VertexID & 1), size - 1);
+    const vec2 cell = vec2(min(x * cellScale, terrainSize - 1), min(z * cellScale, terrainSize - 1));
+    const vec3 position = vec3(cell.x, heightAt(x, z), cell.y);
+
+    // central differences of the neighbouring water heights
+    const vec3 normal = vec3(heightAt(x - 1, z) - heightAt(x + 1, z), 2.0 * cellScale, heightAt(x, z - 1) - heightAt(x, z + 1));
     
     vs_out.normal = normalize(transpose(inverse(mat3(model))) * normalize(normal));
     vs_out.position = (vec4(position, 1.0) * model).xyz;
-    vs_out.terrainHeight = terrainHeight;
+    vs_out.terrainCell = cell;
 
     gl_Position = mvp * vec4(position, 1.0);
 }
\ No newline at end of file
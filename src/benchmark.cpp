@@ -0,0 +1,233 @@
+#include "benchmark.hpp"
+#include "noise.hpp"
+#include "erosionBackend.hpp"
+#include "heightmapGenerator.hpp"
+#include "erosionTuning.hpp"
+#include "taskScheduler.hpp"
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+    constexpr int NOISE_SAMPLES = 1 << 22;
+    constexpr int PARITY_WIDTH = 512;
+    constexpr int EROSION_WIDTH = 512;
+    constexpr int EROSION_STEPS = 200;
+    constexpr int TUNE_WARMUP_STEPS = 5;
+    constexpr int TUNE_STEPS = 30;
+
+    struct NoiseStats {
+        float min, max, mean, std;
+    };
+
+    volatile float benchSink = 0.0f; // stops the compiler discarding benchmarked calls
+
+    template <typename F>
+    double timeNsPerSample(F noise) {
+        // sample along a diagonal strip so successive calls hit different cells
+        float sum = 0.0f;
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < NOISE_SAMPLES; i++) {
+            sum += noise((float)(i & 4095) * 0.731f, (float)(i >> 12) * 0.617f);
+        }
+        const auto end = std::chrono::high_resolution_clock::now();
+        benchSink = sum;
+        return std::chrono::duration<double, std::nano>(end - start).count() / NOISE_SAMPLES;
+    }
+
+    NoiseStats sampleTerrainNoise(NoiseBasis basis, std::vector<float>& out) {
+        // same octave settings as the default mountain layer in Terrain::generateHeightmap
+        out.resize(PARITY_WIDTH * PARITY_WIDTH);
+        double sum = 0.0, sumSq = 0.0;
+        for (int z = 0; z < PARITY_WIDTH; z++) {
+            for (int x = 0; x < PARITY_WIDTH; x++) {
+                const float n = fractalOctave(basis, 12, 0.005f, 0.5f, 2.0f, x * 0.25f + 512.0f, z * 0.25f + 512.0f);
+                out[z * PARITY_WIDTH + x] = n;
+                sum += n;
+                sumSq += (double)n * n;
+            }
+        }
+        const double mean = sum / out.size();
+        const auto range = std::minmax_element(out.begin(), out.end());
+        return { *range.first, *range.second, (float)mean, (float)std::sqrt(sumSq / out.size() - mean * mean) };
+    }
+
+    // ms per step of one configuration, from a fresh seed after a few steps to warm caches and wake workers
+    double timeTuning(const ErosionTuning& tuning, const HeightmapResult& heightmap, int width, ErosionParams params) {
+        erosionTuning::apply(tuning);
+        std::vector<float> heights(heightmap.heights.begin(), heightmap.heights.end());
+        std::vector<float> water(heights.size(), 0.0f);
+        std::unique_ptr<ErosionBackend> backend = createErosionBackend(tuning.backend);
+        backend->init(heights.data(), water.data(), width, width);
+        backend->seed(params);
+        backend->step(TUNE_WARMUP_STEPS, params);
+        backend->resetStats();
+        backend->step(TUNE_STEPS, params);
+        return backend->msPerStep();
+    }
+
+    void writePGM(const char* path, const std::vector<float>& values) {
+        std::ofstream file(path, std::ios::binary);
+        file << "P5\n" << PARITY_WIDTH << " " << PARITY_WIDTH << "\n255\n";
+        for (const float v : values) {
+            file.put((char)(unsigned char)std::clamp(v * 255.0f, 0.0f, 255.0f));
+        }
+    }
+}
+
+int runNoiseBenchmark() {
+    std::cout << "Noise basis benchmark (" << NOISE_SAMPLES << " samples)" << std::endl;
+    std::cout << "  perlin          " << timeNsPerSample(perlin) << " ns/sample" << std::endl;
+    std::cout << "  simplex         " << timeNsPerSample(simplex) << " ns/sample" << std::endl;
+    std::cout << "  perlinOctave12  " << timeNsPerSample([](float x, float y) {
+        return perlinOctave(12, 0.005f, 0.5f, 2.0f, x, y); }) << " ns/sample" << std::endl;
+    std::cout << "  simplexOctave12 " << timeNsPerSample([](float x, float y) {
+        return simplexOctave(12, 0.005f, 0.5f, 2.0f, x, y); }) << " ns/sample" << std::endl;
+
+    // parity check, both bases should cover the 0-1 range with a similar distribution
+    std::vector<float> perlinImage, simplexImage;
+    const NoiseStats p = sampleTerrainNoise(NoiseBasis::PERLIN, perlinImage);
+    const NoiseStats s = sampleTerrainNoise(NoiseBasis::SIMPLEX, simplexImage);
+    std::cout << "Parity check (" << PARITY_WIDTH << "x" << PARITY_WIDTH << ", 12 octaves)" << std::endl;
+    std::cout << "  perlin  min " << p.min << " max " << p.max << " mean " << p.mean << " std " << p.std << std::endl;
+    std::cout << "  simplex min " << s.min << " max " << s.max << " mean " << s.mean << " std " << s.std << std::endl;
+
+    writePGM("noise_perlin.pgm", perlinImage);
+    writePGM("noise_simplex.pgm", simplexImage);
+    std::cout << "Wrote noise_perlin.pgm and noise_simplex.pgm for visual comparison" << std::endl;
+    return 0;
+}
+
+int runErosionBenchmark() {
+    // the same generated terrain and parameters for every backend
+    HeightmapParams heightmapParams;
+    heightmapParams.width = EROSION_WIDTH;
+    HeightmapResult heightmap;
+    HeightmapGenerator::generate(heightmapParams, nullptr, 1, heightmap);
+    ErosionParams params;
+    params.maxHeight = heightmap.maxHeight;
+
+    // GL backends need a context, a hidden window is enough
+    GLFWwindow* context = nullptr;
+    if (glfwInit()) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(64, 64, "FractalErode", NULL, NULL);
+        if (context) {
+            glfwMakeContextCurrent(context);
+            if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+                glfwDestroyWindow(context);
+                context = nullptr;
+            }
+        }
+    }
+
+    std::cout << "Erosion backend benchmark (" << EROSION_WIDTH << "x" << EROSION_WIDTH << ", "
+        << EROSION_STEPS << " steps), height differences against the first backend" << std::endl;
+    std::vector<float> reference;
+    for (const ErosionBackendInfo& info : erosionBackends()) {
+        if (info.needsGL && !context) {
+            std::cout << "  " << info.name << " skipped, no OpenGL 4.3 context" << std::endl;
+            continue;
+        }
+
+        std::vector<float> heights(heightmap.heights.begin(), heightmap.heights.end());
+        std::vector<float> water(heights.size(), 0.0f);
+        std::unique_ptr<ErosionBackend> backend = info.create();
+        backend->init(heights.data(), water.data(), EROSION_WIDTH, EROSION_WIDTH);
+        backend->seed(params);
+        backend->step(EROSION_STEPS, params);
+        backend->readState();
+
+        double maxDiff = 0.0, meanDiff = 0.0;
+        if (reference.empty()) {
+            reference = heights;
+        }
+        else {
+            for (size_t i = 0; i < heights.size(); i++) {
+                const double diff = std::fabs(heights[i] - reference[i]);
+                maxDiff = std::max(maxDiff, diff);
+                meanDiff += diff;
+            }
+            meanDiff /= heights.size();
+        }
+
+        const double msPerStep = backend->msPerStep();
+        std::cout << "  " << info.name << "\t" << msPerStep << " ms/step  "
+            << (double)EROSION_WIDTH * EROSION_WIDTH / (msPerStep * 1000.0) << " Mcells/s  "
+            << "max diff " << maxDiff << " mean diff " << meanDiff << std::endl;
+    }
+
+    if (context)
+        glfwDestroyWindow(context);
+    glfwTerminate();
+    return 0;
+}
+
+int runErosionAutotune(int width) {
+    HeightmapParams heightmapParams;
+    heightmapParams.width = width;
+    HeightmapResult heightmap;
+    HeightmapGenerator::generate(heightmapParams, nullptr, 1, heightmap);
+    ErosionParams params;
+    params.maxHeight = heightmap.maxHeight;
+
+    std::cout << "Erosion autotune (" << width << "x" << width << ", " << TUNE_STEPS << " steps per configuration)" << std::endl;
+    ErosionTuning best;
+    best.threads = TaskScheduler::get().getThreadBudget();
+    best.chunksPerThread = TaskScheduler::get().getChunksPerThread();
+    best.msPerStep = 0.0;
+    const auto tryTuning = [&](const ErosionTuning& tuning) {
+        const double msPerStep = timeTuning(tuning, heightmap, width, params);
+        std::cout << "  " << tuning.backend << "\tthreads " << tuning.threads << "\tchunks/thread " << tuning.chunksPerThread
+            << "\t" << msPerStep << " ms/step" << std::endl;
+        if (best.msPerStep == 0.0 || msPerStep < best.msPerStep) {
+            best = tuning;
+            best.msPerStep = msPerStep;
+        }
+    };
+
+    // one setting at a time, each searched with the best of those before it, the kernel variant mattering most
+    // only backends stepping the same algorithm as the scalar reference are candidates, so the winner is picked on speed
+    // alone without changing the results, tiled erosion and the GL backends are chosen by hand
+    for (const char* name : { "cpu", "simd" }) {
+        ErosionTuning tuning = best;
+        tuning.backend = name;
+        tryTuning(tuning);
+    }
+
+    const int maxThreads = TaskScheduler::get().getMaxThreads();
+    ErosionTuning base = best;
+    for (int threads = 1; threads < maxThreads * 2; threads *= 2) {
+        ErosionTuning tuning = base;
+        tuning.threads = std::min(threads, maxThreads);
+        if (tuning.threads != base.threads)
+            tryTuning(tuning);
+    }
+
+    base = best;
+    for (int chunks = 1; chunks <= 16; chunks *= 2) {
+        ErosionTuning tuning = base;
+        tuning.chunksPerThread = chunks;
+        if (chunks != base.chunksPerThread)
+            tryTuning(tuning);
+    }
+
+    std::cout << "Fastest: " << best.backend << ", " << best.threads << " threads, " << best.chunksPerThread
+        << " chunks per thread, " << best.msPerStep << " ms/step" << std::endl;
+    if (!erosionTuning::save(best)) {
+        std::cout << "Could not write " << erosionTuning::path() << std::endl;
+        return -1;
+    }
+    std::cout << "Saved to " << erosionTuning::path() << ", loaded on every run on this machine" << std::endl;
+    return 0;
+}
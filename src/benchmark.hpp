@@ -0,0 +1,10 @@
+#ifndef BENCHMARK_HPP_INCLUDED
+#define BENCHMARK_HPP_INCLUDED
+
+// headless benchmarks, selected from the command line before any window is created
+int runNoiseBenchmark();
+int runErosionBenchmark();
+// times erosion configurations on a grid of the given width and saves the fastest for later runs to load
+int runErosionAutotune(int width);
+
+#endif
@@ -0,0 +1,321 @@
+#include "chunkManager.hpp"
+#include "noise.hpp"
+#include "taskScheduler.hpp"
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+
+ChunkManager::~ChunkManager() {
+    clean();
+}
+
+void ChunkManager::init(const HeightmapParams& params_, const ErosionParams& erosionParams_, int nWorkers) {
+    clean();
+    params = params_;
+    erosionParams = erosionParams_;
+    chunkErosionSteps = erosionSteps;
+    // rain is scaled against the highest possible height so every chunk receives the same rain
+    erosionParams.maxHeight = params.minHeight + params.amplitude;
+    generation++;
+    stopping = false;
+    chunksRunning = true;
+
+    // chunks may use every worker the scheduler has unless limited
+    maxTasks = nWorkers > 0 ? nWorkers : TaskScheduler::get().getThreadBudget();
+}
+
+void ChunkManager::clean() {
+    // wait for chunk tasks to return, any chunk being generated is discarded and stops eroding
+    chunksRunning = false;
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        stopping = true;
+        pending.clear();
+        queueCondition.wait(lock, [this] { return runningTasks == 0; });
+    }
+    {
+        std::lock_guard<std::mutex> lock(regionMutex);
+        erodedRegions.clear();
+    }
+
+    completed.clear();
+    requested.clear();
+    for (std::unique_ptr<TerrainChunk>& chunk : resident) {
+        chunk->mesh.clean();
+    }
+    resident.clear();
+    residentLookup.clear();
+    maxHeight = 0.0f;
+}
+
+int ChunkManager::pendingCount() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return (int)requested.size();
+}
+
+void ChunkManager::update(const Vec3& cameraCell) {
+    const ChunkCoord centre{
+        (int)std::floor(cameraCell.x / CHUNK_CELLS),
+        (int)std::floor(cameraCell.z / CHUNK_CELLS)
+    };
+    const int viewCount = (2 * viewRadius + 1) * (2 * viewRadius + 1);
+    maxResidentChunks = std::max(maxResidentChunks, viewCount);
+
+    std::vector<std::unique_ptr<TerrainChunk>> ready;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        cameraChunk = centre;
+
+        // drop requests the camera has moved away from before they are started
+        auto outOfView = [&](const ChunkCoord& coord) {
+            return std::abs(coord.x - centre.x) > viewRadius + 1 || std::abs(coord.z - centre.z) > viewRadius + 1;
+        };
+        for (const ChunkCoord& coord : pending) {
+            if (outOfView(coord))
+                requested.erase(coord);
+        }
+        pending.erase(std::remove_if(pending.begin(), pending.end(), outOfView), pending.end());
+
+        // mark chunks in view as recently used, requesting any that are missing
+        for (int z = centre.z - viewRadius; z <= centre.z + viewRadius; z++) {
+            for (int x = centre.x - viewRadius; x <= centre.x + viewRadius; x++) {
+                const ChunkCoord coord{ x, z };
+                auto found = residentLookup.find(coord);
+                if (found != residentLookup.end())
+                    resident.splice(resident.begin(), resident, found->second);
+                else
+                    request(coord);
+            }
+        }
+
+        // take a few completed chunks each frame so uploads do not stall the render loop
+        const int nReady = std::min((int)completed.size(), UPLOADS_PER_FRAME);
+        for (int i = 0; i < nReady; i++) {
+            requested.erase(completed.back()->coord);
+            if (completed.back()->generation == generation)
+                ready.push_back(std::move(completed.back()));
+            completed.pop_back();
+        }
+        dispatch();
+    }
+
+    // upload new chunks outside of the lock
+    for (std::unique_ptr<TerrainChunk>& chunk : ready) {
+        chunk->mesh.sendGPU();
+        maxHeight = std::max(maxHeight, chunk->maxHeight);
+        resident.push_front(std::move(chunk));
+        residentLookup[resident.front()->coord] = resident.begin();
+    }
+    evict();
+}
+
+void ChunkManager::render() {
+    // expects the terrain shader to be bound, chunk origin is passed to it per draw
+    glUniform1i(19, 1);
+    for (std::unique_ptr<TerrainChunk>& chunk : resident) {
+        glUniform2f(18, (float)(chunk->coord.x * CHUNK_CELLS), (float)(chunk->coord.z * CHUNK_CELLS));
+        chunk->mesh.render();
+    }
+}
+
+void ChunkManager::request(ChunkCoord coord) {
+    // queueMutex must be held
+    if (requested.count(coord))
+        return;
+    requested[coord] = true;
+    pending.push_back(coord);
+}
+
+void ChunkManager::evict() {
+    // least recently used chunks are at the back, chunks in view are always at the front
+    while ((int)resident.size() > maxResidentChunks) {
+        std::unique_ptr<TerrainChunk>& chunk = resident.back();
+        chunk->mesh.clean();
+        residentLookup.erase(chunk->coord);
+        resident.pop_back();
+    }
+}
+
+void ChunkManager::dispatch() {
+    // queueMutex must be held, each task keeps taking pending chunks until none are left
+    while (!stopping && runningTasks < maxTasks && runningTasks < (int)pending.size()) {
+        runningTasks++;
+        TaskScheduler::get().submit([this] { chunkTask(); }, TaskScheduler::LOW);
+    }
+}
+
+void ChunkManager::chunkTask() {
+    while (true) {
+        ChunkCoord coord;
+        unsigned int chunkGeneration;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (stopping || pending.empty()) {
+                runningTasks--;
+                queueCondition.notify_all();
+                return;
+            }
+
+            // prioritise the pending chunk closest to the camera
+            auto closest = std::min_element(pending.begin(), pending.end(), [this](const ChunkCoord& a, const ChunkCoord& b) {
+                const int distA = std::max(std::abs(a.x - cameraChunk.x), std::abs(a.z - cameraChunk.z));
+                const int distB = std::max(std::abs(b.x - cameraChunk.x), std::abs(b.z - cameraChunk.z));
+                return distA < distB;
+            });
+            coord = *closest;
+            *closest = pending.back();
+            pending.pop_back();
+            chunkGeneration = generation;
+        }
+
+        std::unique_ptr<TerrainChunk> chunk = generateChunk(coord, chunkGeneration);
+
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!stopping && chunk)
+            completed.push_back(std::move(chunk));
+    }
+}
+
+namespace {
+    // weights of the regions before, of and after a chunk at a cell along one axis
+    // regions are cross-faded linearly across the whole of their overlap, so the weights only depend on world position
+    // and reach zero before a region's own border, where its erosion has no context
+    void overlapWeights(int cell, float weights[3]) {
+        constexpr int CELLS = ChunkManager::CHUNK_CELLS;
+        constexpr float OVERLAP = 64.0f; // twice the erosion margin
+        weights[0] = std::clamp((OVERLAP / 2 - cell) / OVERLAP, 0.0f, 1.0f);
+        weights[2] = std::clamp((cell - (CELLS - OVERLAP / 2)) / OVERLAP, 0.0f, 1.0f);
+        weights[1] = 1.0f - weights[0] - weights[2];
+    }
+}
+
+std::vector<float> ChunkManager::sampleRegion(ChunkCoord coord, int margin) const {
+    // noise is sampled in world coordinates so neighbouring chunks agree along their shared edges
+    const int originX = coord.x * CHUNK_CELLS;
+    const int originZ = coord.z * CHUNK_CELLS;
+    const int regionVerts = CHUNK_VERTS + 2 * margin;
+
+    // warp field samples must line up with the world grid, so start it a whole number of warp samples before the margin
+    WarpField warpField;
+    const bool coarseWarp = params.domainWarpAmplitude > 0.0f && params.domainWarpResolution > 1;
+    if (coarseWarp) {
+        const int resolution = params.domainWarpResolution;
+        const int warpMargin = ((margin + resolution - 1) / resolution) * resolution;
+        warpField.generate(params, originX - warpMargin, originZ - warpMargin,
+            CHUNK_VERTS + 2 * warpMargin, CHUNK_VERTS + 2 * warpMargin);
+    }
+
+    std::vector<float> region(regionVerts * regionVerts);
+    for (int j = 0; j < regionVerts; j++) {
+        for (int i = 0; i < regionVerts; i++) {
+            region[j * regionVerts + i] = HeightmapGenerator::sampleHeight(params,
+                coarseWarp ? &warpField : nullptr, originX + i - margin, originZ + j - margin);
+        }
+    }
+    return region;
+}
+
+std::shared_ptr<const std::vector<float>> ChunkManager::erodedRegion(ChunkCoord coord) {
+    {
+        std::lock_guard<std::mutex> lock(regionMutex);
+        auto found = erodedRegions.find(coord);
+        if (found != erodedRegions.end())
+            return found->second;
+    }
+
+    // eroded on this thread alone so a region eroded again, by two chunks at once or after being dropped,
+    // comes out bit for bit the same, chunks are already generated in parallel
+    const int regionVerts = CHUNK_VERTS + 2 * EROSION_MARGIN;
+    std::vector<float> region = sampleRegion(coord, EROSION_MARGIN);
+    std::vector<float> water(region.size());
+    {
+        TaskScheduler::SerialScope serial;
+        if (!erodeRegionCPU(region.data(), water.data(), regionVerts, regionVerts, erosionParams, chunkErosionSteps,
+            &chunksRunning))
+            return nullptr;
+    }
+    std::shared_ptr<const std::vector<float>> eroded = std::make_shared<const std::vector<float>>(std::move(region));
+
+    ChunkCoord centre;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        centre = cameraChunk;
+    }
+    std::lock_guard<std::mutex> lock(regionMutex);
+    erodedRegions.emplace(coord, eroded);
+    // regions out of reach of the chunks in view are dropped once there are more than the chunks that can be resident
+    if ((int)erodedRegions.size() > maxResidentChunks) {
+        for (auto it = erodedRegions.begin(); it != erodedRegions.end();) {
+            const int distance = std::max(std::abs(it->first.x - centre.x), std::abs(it->first.z - centre.z));
+            it = distance > viewRadius + 2 ? erodedRegions.erase(it) : std::next(it);
+        }
+    }
+    return eroded;
+}
+
+std::unique_ptr<TerrainChunk> ChunkManager::generateChunk(ChunkCoord coord, unsigned int chunkGeneration) {
+    std::unique_ptr<TerrainChunk> chunk = std::make_unique<TerrainChunk>();
+    chunk->coord = coord;
+    chunk->generation = chunkGeneration;
+
+    // the mesh keeps a one vertex halo so normals along the chunk edges see the neighbouring chunk
+    constexpr int HALO_VERTS = CHUNK_VERTS + 2;
+    const std::vector<float> region = sampleRegion(coord, 1);
+    chunk->altitude.resize(CHUNK_VERTS * CHUNK_VERTS);
+    for (int z = 0; z < CHUNK_VERTS; z++) {
+        std::copy_n(&region[(z + 1) * HALO_VERTS + 1], CHUNK_VERTS, &chunk->altitude[z * CHUNK_VERTS]);
+    }
+
+    if (chunkErosionSteps > 0) {
+        // cells near the edges blend this chunk's eroded region with its neighbours', which erode the same cells
+        // in their margins, the weights depend only on world position so chunks sharing an edge agree along it
+        std::shared_ptr<const std::vector<float>> regions[3][3];
+        for (int dZ = -1; dZ <= 1; dZ++) {
+            for (int dX = -1; dX <= 1; dX++) {
+                regions[dZ + 1][dX + 1] = erodedRegion({ coord.x + dX, coord.z + dZ });
+                if (!regions[dZ + 1][dX + 1])
+                    return nullptr;
+            }
+        }
+
+        constexpr int REGION_VERTS = CHUNK_VERTS + 2 * EROSION_MARGIN;
+        chunk->heights.resize(HALO_VERTS * HALO_VERTS);
+        for (int z = 0; z < HALO_VERTS; z++) {
+            float weightsZ[3];
+            overlapWeights(z - 1, weightsZ);
+            for (int x = 0; x < HALO_VERTS; x++) {
+                float weightsX[3];
+                overlapWeights(x - 1, weightsX);
+                float height = 0.0f;
+                for (int dZ = -1; dZ <= 1; dZ++) {
+                    for (int dX = -1; dX <= 1; dX++) {
+                        const float weight = weightsZ[dZ + 1] * weightsX[dX + 1];
+                        if (weight == 0.0f)
+                            continue;
+                        const int regionX = x - 1 - dX * CHUNK_CELLS + EROSION_MARGIN;
+                        const int regionZ = z - 1 - dZ * CHUNK_CELLS + EROSION_MARGIN;
+                        height += weight * (*regions[dZ + 1][dX + 1])[regionZ * REGION_VERTS + regionX];
+                    }
+                }
+                chunk->heights[z * HALO_VERTS + x] = height;
+            }
+        }
+    }
+    else {
+        chunk->heights = region;
+    }
+
+    for (int z = 1; z <= CHUNK_VERTS; z++) {
+        for (int x = 1; x <= CHUNK_VERTS; x++) {
+            chunk->maxHeight = std::max(chunk->maxHeight, chunk->heights[z * HALO_VERTS + x]);
+        }
+    }
+
+    // chunks are uploaded once, so need no spare upload slots
+    chunk->mesh.init(1.0f, CHUNK_VERTS, CHUNK_VERTS, 1, 1);
+    // every chunk shares one quantisation range so heights along shared edges decode identically
+    chunk->mesh.setMaxHeight(erosionParams.maxHeight);
+    chunk->mesh.generate(chunk->altitude.data(), chunk->heights.data());
+    return chunk;
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+#ifndef CHUNK_MANAGER_HPP_INCLUDED
+#define CHUNK_MANAGER_HPP_INCLUDED
+
+#include "terrainMesh.hpp"
+#include "heightmapGenerator.hpp"
+#include "erosionKernels.hpp"
+#include "vec3.hpp"
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+struct ChunkCoord {
+    int x;
+    int z;
+
+    bool operator==(const ChunkCoord& rhs) const {
+        return x == rhs.x && z == rhs.z;
+    }
+};
+
+struct ChunkCoordHash {
+    size_t operator()(const ChunkCoord& coord) const {
+        return std::hash<long long>()(((long long)coord.x << 32) ^ (unsigned int)coord.z);
+    }
+};
+
+struct TerrainChunk {
+    ChunkCoord coord{ 0, 0 };
+    unsigned int generation = 0;
+    std::vector<float> heights; // with a one vertex halo from the neighbouring chunks
+    std::vector<float> altitude; // height before erosion
+    float maxHeight = 0.0f;
+    TerrainMesh mesh;
+};
+
+// streams fixed size heightmap chunks in around the camera, generated in world coordinates by background scheduler tasks
+// resident chunks are kept in an LRU so memory is bounded regardless of how far the camera travels
+class ChunkManager {
+public:
+    static constexpr int CHUNK_CELLS = 256;
+    static constexpr int CHUNK_VERTS = CHUNK_CELLS + 1; // edge vertices are shared with neighbouring chunks
+private:
+    static constexpr int UPLOADS_PER_FRAME = 2;
+    static constexpr int EROSION_MARGIN = 32; // cells of context eroded around each chunk, cross-faded with its neighbours'
+
+    HeightmapParams params;
+    ErosionParams erosionParams;
+    int chunkErosionSteps = 0;
+    std::atomic<unsigned int> generation = 0;
+
+    // resident chunks, most recently used at the front
+    std::list<std::unique_ptr<TerrainChunk>> resident;
+    std::unordered_map<ChunkCoord, std::list<std::unique_ptr<TerrainChunk>>::iterator, ChunkCoordHash> residentLookup;
+
+    // chunks are generated by scheduler tasks, pending requests are taken closest to the camera first
+    int maxTasks = 1;
+    int runningTasks = 0; // submitted and not yet returned, guarded by queueMutex
+    std::mutex queueMutex;
+    std::condition_variable queueCondition; // signalled as tasks return
+    std::vector<ChunkCoord> pending;
+    std::unordered_map<ChunkCoord, bool, ChunkCoordHash> requested; // pending or being generated
+    std::vector<std::unique_ptr<TerrainChunk>> completed;
+    ChunkCoord cameraChunk{ 0, 0 };
+    bool stopping = false;
+    std::atomic<bool> chunksRunning = false; // cleared by clean so chunks part way through erosion give up
+
+    // eroded regions of chunks and their margins, kept so each is eroded once for itself and the chunks around it
+    std::mutex regionMutex;
+    std::unordered_map<ChunkCoord, std::shared_ptr<const std::vector<float>>, ChunkCoordHash> erodedRegions;
+
+    void chunkTask();
+    void dispatch();
+    std::vector<float> sampleRegion(ChunkCoord, int margin) const;
+    std::shared_ptr<const std::vector<float>> erodedRegion(ChunkCoord);
+    // null if cancelled
+    std::unique_ptr<TerrainChunk> generateChunk(ChunkCoord, unsigned int);
+    void request(ChunkCoord);
+    void evict();
+public:
+    int viewRadius = 3; // in chunks
+    int maxResidentChunks = 64;
+    int erosionSteps = 0; // erosion iterations run on each chunk as it is generated, applied on init
+    float maxHeight = 0.0f;
+
+    ChunkManager() = default;
+    ChunkManager(const ChunkManager&) = delete;
+    ~ChunkManager();
+
+    void init(const HeightmapParams&, const ErosionParams& = ErosionParams(), int nWorkers = 0);
+    void update(const Vec3& cameraCell);
+    void render();
+    void clean();
+
+    inline int residentCount() const { return (int)resident.size(); }
+    int pendingCount();
+};
+
+#endif
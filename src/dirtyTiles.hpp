@@ -0,0 +1,78 @@
+#ifndef DIRTY_TILES_HPP_INCLUDED
+#define DIRTY_TILES_HPP_INCLUDED
+
+#include <vector>
+#include <algorithm>
+
+// coarse changed flags over a grid, one per TILE_SIZE square of cells
+struct DirtyTiles {
+    static constexpr int TILE_SIZE = 32;
+
+    std::vector<unsigned char> flags;
+    int tilesX = 0;
+    int tilesZ = 0;
+
+    inline void resize(int width, int depth);
+    inline void markAll();
+    inline void clear();
+    inline bool any() const;
+    inline void merge(const DirtyTiles& other);
+    inline DirtyTiles dilated() const;
+    inline bool rowDirty(int tileZ) const;
+
+    // safe to call from parallel loops
+    inline void markTile(int tileX, int tileZ) {
+        unsigned char* flag = &flags[tileZ * tilesX + tileX];
+        #pragma omp atomic write
+        *flag = 1;
+    }
+    inline bool tileDirty(int tileX, int tileZ) const { return flags[tileZ * tilesX + tileX] != 0; }
+};
+
+void DirtyTiles::resize(int width, int depth) {
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesZ = (depth + TILE_SIZE - 1) / TILE_SIZE;
+    flags.assign(tilesX * tilesZ, 0);
+}
+
+void DirtyTiles::markAll() {
+    std::fill(flags.begin(), flags.end(), 1);
+}
+
+void DirtyTiles::clear() {
+    std::fill(flags.begin(), flags.end(), 0);
+}
+
+bool DirtyTiles::any() const {
+    return std::find(flags.begin(), flags.end(), 1) != flags.end();
+}
+
+void DirtyTiles::merge(const DirtyTiles& other) {
+    for (size_t i = 0; i < flags.size(); i++) {
+        flags[i] |= other.flags[i];
+    }
+}
+
+DirtyTiles DirtyTiles::dilated() const {
+    // also marks the 8 neighbours of every dirty tile, for filters that read one cell past a tile
+    DirtyTiles result = *this;
+    for (int z = 0; z < tilesZ; z++) {
+        for (int x = 0; x < tilesX; x++) {
+            if (!tileDirty(x, z))
+                continue;
+            for (int nz = std::max(z - 1, 0); nz <= std::min(z + 1, tilesZ - 1); nz++) {
+                for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, tilesX - 1); nx++) {
+                    result.flags[nz * tilesX + nx] = 1;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+bool DirtyTiles::rowDirty(int tileZ) const {
+    const auto row = flags.begin() + tileZ * tilesX;
+    return std::find(row, row + tilesX, 1) != row + tilesX;
+}
+
+#endif
@@ -0,0 +1,205 @@
+#include "erosionBackend.hpp"
+#include "gpuErosionBackend.hpp"
+#include "hybridErosionBackend.hpp"
+#include "gridMemory.hpp"
+#include "taskScheduler.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <limits>
+
+void ErosionBackend::init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_) {
+    heights = heights_;
+    water = water_;
+    width = width_;
+    depth = depth_;
+    dirty = dirty_;
+    stepsRun = 0;
+}
+
+int ErosionBackend::step(int n, const ErosionParams& params, const std::atomic<bool>* running) {
+    const auto start = std::chrono::steady_clock::now();
+    const int done = runSteps(n, params, running);
+    stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.steps += done;
+    return done;
+}
+
+int ErosionBackend::stepRows(int rows, int maxSteps, const ErosionParams& params) {
+    const auto start = std::chrono::steady_clock::now();
+    const int done = runRows(rows, maxSteps, params);
+    stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.steps += done;
+    return done;
+}
+
+namespace {
+    // the scatter kernels with their rows spread over the task scheduler
+    class ParallelErosionBackend : public ErosionBackend {
+    protected:
+        Grid<float> heightOut;
+        Grid<float> waterOut;
+        Grid<float> sedimentIn;
+        Grid<float> sedimentOut;
+        ErosionStepSlicer slicer;
+        // scratch totals of backends running the gather kernels, slices run the scatter kernels without them
+        float* totalDeltaHW = nullptr;
+        float* totalDeltaH = nullptr;
+
+        ErosionGrid grid() {
+            return { heights, heightOut.data(), water, waterOut.data(),
+                sedimentIn.data(), sedimentOut.data(), width, depth, dirty };
+        }
+
+        // a step left part way by runRows is finished before any whole ones, returns 1 if there was one
+        int finishSlicedStep(const ErosionParams& params) {
+            if (!slicer.midStep())
+                return 0;
+            int rows = std::numeric_limits<int>::max();
+            slicer.run(grid(), params, stepsRun++, rows, totalDeltaHW, totalDeltaH);
+            return 1;
+        }
+
+        int runSteps(int n, const ErosionParams& params, const std::atomic<bool>* running) override {
+            const ErosionGrid buffers = grid();
+            int done = n > 0 ? finishSlicedStep(params) : 0;
+            for (; done < n && (!running || *running); done++) {
+                erosionStepCPU(buffers, params, stepsRun++);
+            }
+            return done;
+        }
+
+        int runRows(int rows, int maxSteps, const ErosionParams& params) override {
+            const ErosionGrid buffers = grid();
+            int done = 0;
+            while (rows > 0 && done < maxSteps && slicer.run(buffers, params, stepsRun, rows, totalDeltaHW, totalDeltaH)) {
+                stepsRun++;
+                done++;
+            }
+            return done;
+        }
+    public:
+        void init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_) override {
+            ErosionBackend::init(heights_, water_, width_, depth_, dirty_);
+            // first touched in parallel so pages are spread over the nodes of the threads eroding them
+            resizeGrid(heightOut, width * depth, width);
+            resizeGrid(waterOut, width * depth, width);
+            resizeGrid(sedimentIn, width * depth, width);
+            resizeGrid(sedimentOut, width * depth, width);
+        }
+
+        void seed(const ErosionParams& params) override {
+            seedWaterCPU(grid(), params);
+            slicer.reset();
+            stepsRun = 0;
+        }
+
+        bool sliceable() const override { return true; }
+    };
+
+    // the same kernels on the calling thread only, the reference the others are compared against
+    class ScalarErosionBackend : public ParallelErosionBackend {
+    protected:
+        int runSteps(int n, const ErosionParams& params, const std::atomic<bool>* running) override {
+            TaskScheduler::SerialScope serial;
+            return ParallelErosionBackend::runSteps(n, params, running);
+        }
+
+        int runRows(int rows, int maxSteps, const ErosionParams& params) override {
+            TaskScheduler::SerialScope serial;
+            return ParallelErosionBackend::runRows(rows, maxSteps, params);
+        }
+    };
+
+    // gather kernels, each cell only writes itself so rows vectorise without atomics
+    class SimdErosionBackend : public ParallelErosionBackend {
+    private:
+        Grid<float> totalsHW;
+        Grid<float> totalsH;
+    protected:
+        int runSteps(int n, const ErosionParams& params, const std::atomic<bool>* running) override {
+            const ErosionGrid buffers = grid();
+            int done = n > 0 ? finishSlicedStep(params) : 0;
+            for (; done < n && (!running || *running); done++) {
+                erosionStepGatherCPU(buffers, params, stepsRun++, totalDeltaHW, totalDeltaH);
+            }
+            return done;
+        }
+    public:
+        void init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_) override {
+            ParallelErosionBackend::init(heights_, water_, width_, depth_, dirty_);
+            // border totals are never written and must stay zero
+            resizeGrid(totalsHW, width * depth, width, 0.0f);
+            resizeGrid(totalsH, width * depth, width, 0.0f);
+            totalDeltaHW = totalsHW.data();
+            totalDeltaH = totalsH.data();
+        }
+    };
+
+    // independent overlapping tiles, every tile is seeded and eroded for the whole run before results are blended
+    class TiledErosionBackend : public ErosionBackend {
+    private:
+        Grid<float> heightOut;
+        Grid<float> waterOut;
+        std::atomic<int> tilesDone = 0;
+        int nTiles = 1;
+    protected:
+        int runSteps(int n, const ErosionParams& params, const std::atomic<bool>* running) override {
+            const int tile = std::max(params.tileSize, params.tileOverlap);
+            nTiles = ((width + tile - 1) / tile) * ((depth + tile - 1) / tile);
+            tilesDone = 0;
+            if (!erodeTiledCPU(heights, heightOut.data(), waterOut.data(), width, depth,
+                params, n, params.tileSize, params.tileOverlap, running, &tilesDone))
+                return 0;
+            std::copy(heightOut.begin(), heightOut.end(), heights);
+            std::copy(waterOut.begin(), waterOut.end(), water);
+            if (dirty)
+                dirty->markAll();
+            stepsRun += n;
+            return n;
+        }
+    public:
+        void init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_) override {
+            ErosionBackend::init(heights_, water_, width_, depth_, dirty_);
+            resizeGrid(heightOut, width * depth, width);
+            resizeGrid(waterOut, width * depth, width);
+        }
+
+        // every tile seeds its own water
+        void seed(const ErosionParams&) override { stepsRun = 0; }
+
+        bool progressive() const override { return false; }
+        float getProgress() const override { return (float)tilesDone / nTiles; }
+    };
+
+    template <class T>
+    std::unique_ptr<ErosionBackend> create() {
+        return std::make_unique<T>();
+    }
+}
+
+const std::vector<ErosionBackendInfo>& erosionBackends() {
+    static const std::vector<ErosionBackendInfo> backends{
+        { "scalar", "scatter kernels on one thread", false, create<ScalarErosionBackend> },
+        { "cpu", "scatter kernels over the task scheduler", false, create<ParallelErosionBackend> },
+        { "simd", "vectorised gather kernels over the task scheduler", false, create<SimdErosionBackend> },
+        { "tiled", "independent overlapping tiles over the task scheduler", false, create<TiledErosionBackend> },
+        { "gpu", "OpenGL compute shaders", true, create<GPUErosionBackend> },
+        { "hybrid", "bands of rows on the GPU and the task scheduler at once, split by their measured speed", true,
+            create<HybridErosionBackend> },
+    };
+    return backends;
+}
+
+const ErosionBackendInfo* findErosionBackend(const std::string& name) {
+    for (const ErosionBackendInfo& info : erosionBackends()) {
+        if (name == info.name)
+            return &info;
+    }
+    return nullptr;
+}
+
+std::unique_ptr<ErosionBackend> createErosionBackend(const std::string& name) {
+    const ErosionBackendInfo* info = findErosionBackend(name);
+    return info ? info->create() : nullptr;
+}
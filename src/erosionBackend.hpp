@@ -0,0 +1,81 @@
+#ifndef EROSION_BACKEND_HPP_INCLUDED
+#define EROSION_BACKEND_HPP_INCLUDED
+
+#include "erosionKernels.hpp"
+#include "dirtyTiles.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// one implementation of the erosion simulation, eroding a heights and water grid owned by the caller in place
+// water and sediment are kept between calls to step, so a run can be carried on from where it stopped
+class ErosionBackend {
+public:
+    struct Stats {
+        long long steps = 0;
+        double seconds = 0.0;
+    };
+protected:
+    float* heights = nullptr;
+    float* water = nullptr;
+    int width = 0;
+    int depth = 0;
+    DirtyTiles* dirty = nullptr;
+    int stepsRun = 0; // since the last seed, keeps rain falling on the same steps across calls
+    Stats stats;
+
+    // runs up to n steps, returning how many were completed
+    virtual int runSteps(int n, const ErosionParams&, const std::atomic<bool>* running) = 0;
+    // runs rows of passes, see stepRows, for backends that are sliceable
+    virtual int runRows(int, int, const ErosionParams&) { return 0; }
+public:
+    virtual ~ErosionBackend() = default;
+
+    // binds the grids to erode, allocating any state of the same size
+    virtual void init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_ = nullptr);
+    // starts a fresh run from the current heights, covering them with rain water
+    virtual void seed(const ErosionParams&) = 0;
+    // runs n steps, timed in to the stats, stopping early once running is cleared
+    int step(int n, const ErosionParams&, const std::atomic<bool>* running = nullptr);
+    // runs about rows rows of a step's passes, carrying on through up to maxSteps steps, returning how many it completed
+    // a step left part way is finished by the next call to this or step, timed in to the stats like step
+    int stepRows(int rows, int maxSteps, const ErosionParams&);
+    // brings the bound grids up to date, for backends eroding a copy of them elsewhere
+    virtual void readState() {}
+
+    // GL backends run on the render thread, everything else on the scheduler
+    virtual bool needsGL() const { return false; }
+    // steps can be run a few at a time with the grids consistent in between, so runs can be shown and paused
+    virtual bool progressive() const { return true; }
+    // steps can be run a range of rows at a time with stepRows, so one longer than a frame can be spread over several
+    virtual bool sliceable() const { return false; }
+    // fraction of a step call done, for backends that are not progressive
+    virtual float getProgress() const { return -1.0f; }
+    // backends on another device can queue steps and return straight away, so the caller never waits on them
+    virtual bool canQueue() const { return false; }
+    virtual void setQueueing(bool) {}
+    // false until the steps queued by the last call have finished
+    virtual bool idle() { return true; }
+
+    inline int getStepsRun() const { return stepsRun; }
+    inline const Stats& getStats() const { return stats; }
+    inline void resetStats() { stats = Stats(); }
+    inline double msPerStep() const { return stats.steps ? stats.seconds * 1000.0 / stats.steps : 0.0; }
+};
+
+// registry of backends selectable by name from the UI and command line
+struct ErosionBackendInfo {
+    const char* name;
+    const char* description;
+    bool needsGL;
+    std::function<std::unique_ptr<ErosionBackend>()> create;
+};
+
+const std::vector<ErosionBackendInfo>& erosionBackends();
+const ErosionBackendInfo* findErosionBackend(const std::string& name);
+std::unique_ptr<ErosionBackend> createErosionBackend(const std::string& name);
+
+#endif
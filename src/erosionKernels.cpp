@@ -0,0 +1,702 @@
+#include "erosionKernels.hpp"
+
+#include "taskScheduler.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <type_traits>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// kernels run rows as scheduler parallel loops, when called from inside another parallel loop (e.g. one tile per thread)
+// they run on the calling thread only, scattered writes go through atomicAdd as rows on other threads touch the same cells
+
+namespace {
+    // compare and swap on the float's bits, so scattered adds stay atomic whether or not OpenMP is compiled in
+    inline void atomicAdd(float& target, float value) {
+#if defined(_MSC_VER)
+        volatile long* bits = reinterpret_cast<volatile long*>(&target);
+        long expected = *bits;
+        while (true) {
+            float current;
+            std::memcpy(&current, &expected, sizeof(float));
+            const float sum = current + value;
+            long desired;
+            std::memcpy(&desired, &sum, sizeof(float));
+            const long previous = _InterlockedCompareExchange(bits, desired, expected);
+            if (previous == expected)
+                return;
+            expected = previous;
+        }
+#else
+        float expected;
+        __atomic_load(&target, &expected, __ATOMIC_RELAXED);
+        float desired = expected + value;
+        while (!__atomic_compare_exchange(&target, &expected, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            desired = expected + value;
+        }
+#endif
+    }
+}
+
+void seedWaterCPU(const ErosionGrid& grid, const ErosionParams& params) {
+    const int width = grid.width;
+    TaskScheduler::get().parallelFor(1, grid.depth - 1, [&](int z) {
+        for (int x = 1; x < width - 1; x++) {
+            const int cellIndex = z * width + x;
+            grid.waterIn[cellIndex] = params.rain * (grid.heightIn[cellIndex] / params.maxHeight);
+            grid.sedimentIn[cellIndex] = 0.0f;
+
+            grid.waterOut[cellIndex] = grid.waterIn[cellIndex];
+            grid.sedimentOut[cellIndex] = 0.0f;
+            grid.heightOut[cellIndex] = grid.heightIn[cellIndex];
+        }
+    });
+}
+
+namespace {
+    // every pass of a step reads the In buffers and writes Out, only updateBuffersRows copies Out back in to In,
+    // so a pass can be run over any range of rows [z0, z1) as long as it covers every row before the next pass starts
+    void distributeRainRows(const ErosionGrid& grid, const ErosionParams& params, int z0, int z1) {
+        const int width = grid.width;
+        TaskScheduler::get().parallelFor(z0, z1, [&](int z) {
+            for (int x = 1; x < width - 1; x++) {
+                const int cellIndex = (z * width) + x;
+                grid.waterIn[cellIndex] += params.rain * (grid.heightIn[cellIndex] / params.maxHeight);
+                grid.waterOut[cellIndex] = grid.waterIn[cellIndex];
+            }
+        });
+    }
+}
+
+void distributeRainCPU(const ErosionGrid& grid, const ErosionParams& params) {
+    distributeRainRows(grid, params, 1, grid.depth - 1);
+}
+
+namespace {
+    void hydraulicScatterRows(const ErosionGrid& grid, const ErosionParams& params, int z0, int z1) {
+        const int width = grid.width;
+        const float* heightIn = grid.heightIn;
+        const float* waterIn = grid.waterIn;
+        const float* sedimentIn = grid.sedimentIn;
+        float* heightOut = grid.heightOut;
+        float* waterOut = grid.waterOut;
+        float* sedimentOut = grid.sedimentOut;
+
+        static constexpr int dX[8] = { -1, +0, +1, -1, +1, -1, +0, +1 };
+        static constexpr int dZ[8] = { -1, -1, -1, +0, +0, +1, +1, +1 };
+
+        TaskScheduler::get().parallelFor(z0, z1, [&](int z) {
+            int neighbours[8];
+            float neighboursDeltaH[8];
+            for (int x = 1; x < width - 1; x++) {
+                const int cellIndex = (z * width) + x;
+
+                // skip if no water in current cell
+                if (waterIn[cellIndex] == 0.0f)
+                    continue;
+
+                // grab neighbours
+                float totalDeltaH = 0.0f;
+
+                for (int i = 0; i < 8; i++) {
+                    const int nCellIndex = ((z + dZ[i]) * width) + (x + dX[i]);
+                    // get total difference in height (inc. water)
+                    const float deltaH = (heightIn[cellIndex] + waterIn[cellIndex]) -
+                        (heightIn[nCellIndex] + waterIn[nCellIndex]);
+
+                    if (deltaH > 0.0f) {
+                        totalDeltaH += deltaH;
+                    }
+
+                    neighboursDeltaH[i] = deltaH;
+                    neighbours[i] = nCellIndex;
+                }
+
+                float cellTotalDeltaH = 0.0f;
+                float cellTotalDeltaS = 0.0f;
+                float cellTotalDeltaW = 0.0f;
+
+                // for each neighbour calculate flow of water and sediment
+                for (int n = 0; n < 8; n++) {
+                    const int nCellIndex = neighbours[n];
+                    const float deltaH = neighboursDeltaH[n];
+
+                    // try to move all the excess water out of the cell
+                    float deltaW = std::min(waterIn[cellIndex], deltaH);
+
+                    // neighbour total height (inc water) is higher than current cell
+                    if (deltaW <= 0.0f) {
+                        // deposit some sediment at current cell if altitude is lower
+                        if (heightIn[cellIndex] <= heightIn[nCellIndex]) {
+                            const float sedDeposit = params.kD * sedimentIn[cellIndex];
+                            cellTotalDeltaH += sedDeposit;
+                            cellTotalDeltaS -= sedDeposit;
+                        }
+                    }
+
+                    // neighbour total height (inc. water) is lower than current cell
+                    else {
+                        // calculate movement of water from current cell to neighbour
+                        // scale water to move by difference in heights
+                        deltaW = deltaW * (deltaH / totalDeltaH);
+                        atomicAdd(waterOut[nCellIndex], deltaW);
+                        cellTotalDeltaW -= deltaW;
+
+                        // sediment trying to move from cell to neighbour
+                        const float deltaS = sedimentIn[cellIndex] * (deltaH / totalDeltaH);
+                        // calculate max amount of sediment able to be carried in water at current cell
+                        const float sCap = deltaW * params.kC;
+                        if (deltaS >= sCap) { // deposition
+                            // move max amount of sediment in to neighbouring cell
+                            atomicAdd(sedimentOut[nCellIndex], sCap);
+                            // deposit left over sediment in current cell
+                            const float sedimentToDeposit = params.kD * (deltaS - sCap);
+                            cellTotalDeltaS -= sedimentToDeposit + sCap;
+                            cellTotalDeltaH += sedimentToDeposit;
+                        }
+                        else { // erosion
+                            const float erosionAmount = params.kS * (sCap - deltaS);
+                            cellTotalDeltaH -= erosionAmount;
+                            cellTotalDeltaS -= deltaS;
+                            atomicAdd(sedimentOut[nCellIndex], deltaS + erosionAmount);
+                        }
+                    }
+                }
+                atomicAdd(heightOut[cellIndex], cellTotalDeltaH);
+                atomicAdd(sedimentOut[cellIndex], cellTotalDeltaS);
+                atomicAdd(waterOut[cellIndex], cellTotalDeltaW);
+            }
+        });
+    }
+}
+
+void hydraulicErosionCPU(const ErosionGrid& grid, const ErosionParams& params) {
+    hydraulicScatterRows(grid, params, 1, grid.depth - 1);
+}
+
+namespace {
+    // splits row z in to the cells beside the border and the interior between them, calling cells(edge, x0, x1)
+    // edge is a compile time constant, so interior runs have no per neighbour boundary checks
+    template <class Cells>
+    inline void forRowRuns(int z, int width, int depth, Cells cells) {
+        if (z == 1 || z == depth - 2 || width < 5) {
+            cells(std::true_type(), 1, width - 1);
+            return;
+        }
+        cells(std::true_type(), 1, 2);
+        cells(std::false_type(), 2, width - 2);
+        cells(std::true_type(), width - 2, width - 1);
+    }
+
+    template <bool Edge>
+    void thermalScatterCells(int z, int x0, int x1, int width, int depth, const ErosionParams& params,
+        const float* heightIn, float* heightOut) {
+        static constexpr int dX[8] = { -1, +0, +1, -1, +1, -1, +0, +1 };
+        static constexpr int dZ[8] = { -1, -1, -1, +0, +0, +1, +1, +1 };
+
+        float neighboursDeltaH[8];
+        int neighbours[8];
+        for (int x = x0; x < x1; x++) {
+            float cellTotalDeltaH = 0.0f;
+            const int cellIndex = z * width + x;
+
+            // get neighbours
+            float totalDeltaH = 0.0f;
+            int totalLowerNeighbours = 0;
+            for (int i = 0; i < 8; i++) {
+                // check if neighbour is not a boundary, interior cells have none
+                if (!Edge || (z + dZ[i] > 0 && z + dZ[i] < depth - 1 &&
+                    x + dX[i] > 0 && x + dX[i] < width - 1)) {
+
+                    const int nCellIndex = ((z + dZ[i]) * width) + (x + dX[i]);
+
+                    // get difference in height
+                    const float deltaH = heightIn[cellIndex] - heightIn[nCellIndex];
+                    if (deltaH > params.kT) {
+                        totalDeltaH += deltaH;
+                        neighboursDeltaH[totalLowerNeighbours] = deltaH;
+                        neighbours[totalLowerNeighbours] = nCellIndex;
+                        totalLowerNeighbours++;
+                    }
+                }
+            }
+
+            for (int i = 0; i < totalLowerNeighbours; i++) {
+                const float deltaH = params.cT * (neighboursDeltaH[i] - params.kT) * (neighboursDeltaH[i] / totalDeltaH);
+                cellTotalDeltaH -= deltaH;
+                atomicAdd(heightOut[neighbours[i]], deltaH);
+            }
+            atomicAdd(heightOut[cellIndex], cellTotalDeltaH);
+        }
+    }
+}
+
+namespace {
+    void thermalScatterRows(const ErosionGrid& grid, const ErosionParams& params, int z0, int z1) {
+        const int width = grid.width;
+        const int depth = grid.depth;
+        TaskScheduler::get().parallelFor(z0, z1, [&](int z) {
+            forRowRuns(z, width, depth, [&](auto edge, int x0, int x1) {
+                thermalScatterCells<decltype(edge)::value>(z, x0, x1, width, depth, params, grid.heightIn, grid.heightOut);
+            });
+        });
+    }
+}
+
+void thermalErosionCPU(const ErosionGrid& grid, const ErosionParams& params) {
+    thermalScatterRows(grid, params, 1, grid.depth - 1);
+}
+
+namespace {
+    void updateBuffersRows(const ErosionGrid& grid, const ErosionParams& params, int z0, int z1) {
+        const int width = grid.width;
+        DirtyTiles* dirty = grid.dirty;
+        // use output array as input for next step
+        TaskScheduler::get().parallelFor(z0, z1, [&](int z) {
+            bool tileChanged = false;
+            for (int x = 1; x < width - 1; x++) {
+                const int cellIndex = z * width + x;
+
+                // apply evaporation if any
+                grid.waterOut[cellIndex] *= params.kE;
+                if (grid.waterOut[cellIndex] < 0.000001f) {
+                    grid.heightOut[cellIndex] += grid.sedimentIn[cellIndex];
+                    grid.sedimentOut[cellIndex] = 0.0f;
+                    grid.waterOut[cellIndex] = 0.0f;
+                }
+
+                // flag the tile once its run of cells in this row is done
+                if (dirty) {
+                    tileChanged |= grid.heightOut[cellIndex] != grid.heightIn[cellIndex] ||
+                        grid.waterOut[cellIndex] != grid.waterIn[cellIndex];
+                    if ((x + 1) % DirtyTiles::TILE_SIZE == 0 || x == width - 2) {
+                        if (tileChanged)
+                            dirty->markTile(x / DirtyTiles::TILE_SIZE, z / DirtyTiles::TILE_SIZE);
+                        tileChanged = false;
+                    }
+                }
+
+                grid.heightIn[cellIndex] = grid.heightOut[cellIndex];
+                grid.waterIn[cellIndex] = grid.waterOut[cellIndex];
+                grid.sedimentIn[cellIndex] = grid.sedimentOut[cellIndex];
+            }
+        });
+    }
+}
+
+void updateBuffersCPU(const ErosionGrid& grid, const ErosionParams& params) {
+    updateBuffersRows(grid, params, 1, grid.depth - 1);
+}
+
+namespace {
+    // whole steps instantiated for every combination of enabled features, so none are checked inside a step
+    template <bool Hydraulic, bool Thermal, bool Rain>
+    struct ScatterStep {
+        static void run(const ErosionGrid& grid, const ErosionParams& params, int step) {
+            // perform hydraulic erosion
+            if constexpr (Hydraulic) {
+                // distribute water if it is time to rain
+                if constexpr (Rain) {
+                    if (step % params.rainFrequency == 0)
+                        distributeRainCPU(grid, params);
+                }
+                hydraulicErosionCPU(grid, params);
+            }
+            // Thermal Weathering
+            if constexpr (Thermal)
+                thermalErosionCPU(grid, params);
+
+            updateBuffersCPU(grid, params);
+        }
+    };
+
+    // the narrowest instantiation of Step for the enabled features, rain only falls with hydraulic erosion on
+    template <template <bool, bool, bool> class Step>
+    auto narrowestStep(const ErosionParams& params) {
+        using Kernel = decltype(&Step<false, false, false>::run);
+        static constexpr Kernel kernels[8] = {
+            Step<false, false, false>::run, Step<true, false, false>::run,
+            Step<false, true, false>::run, Step<true, true, false>::run,
+            Step<false, false, true>::run, Step<true, false, true>::run,
+            Step<false, true, true>::run, Step<true, true, true>::run,
+        };
+        const bool rain = params.hydraulicEnabled && params.rainFrequency != 0;
+        return kernels[(params.hydraulicEnabled ? 1 : 0) | (params.thermalEnabled ? 2 : 0) | (rain ? 4 : 0)];
+    }
+}
+
+void erosionStepCPU(const ErosionGrid& grid, const ErosionParams& params, int step) {
+    narrowestStep<ScatterStep>(params)(grid, params, step);
+}
+
+namespace {
+    // calls f(dX, dZ) for each of the 8 neighbours, written out so the calls inline in to branch free row loops
+    template <typename F>
+    inline void forNeighbours(F f) {
+        f(-1, -1); f(+0, -1); f(+1, -1);
+        f(-1, +0);            f(+1, +0);
+        f(-1, +1); f(+0, +1); f(+1, +1);
+    }
+
+    // gather rows take plain restrict pointers and scalars so the vectoriser sees affine, unaliased accesses
+    // every branch is evaluated and selected so the x loops have no control flow, unused lanes may divide by zero
+
+    // only the totals of enabled features are computed, and only edge cells check whether a neighbour is a boundary
+    template <bool Hydraulic, bool Thermal, bool Edge>
+    void totalsCells(int z, int x0, int x1, int width, int depth, float kT,
+        const float* __restrict heightIn, const float* __restrict waterIn,
+        float* __restrict totalDeltaHW, float* __restrict totalDeltaH) {
+        #pragma omp simd
+        for (int x = x0; x < x1; x++) {
+            const int cellIndex = z * width + x;
+            const float cellHeight = heightIn[cellIndex];
+            const float cellTotal = cellHeight + waterIn[cellIndex];
+            float totalHW = 0.0f;
+            float totalH = 0.0f;
+            forNeighbours([&](int dX, int dZ) {
+                const int nCellIndex = cellIndex + dZ * width + dX;
+                // water flows to every neighbour, material only slides on to ones that are not a boundary
+                if constexpr (Hydraulic) {
+                    const float deltaHW = cellTotal - (heightIn[nCellIndex] + waterIn[nCellIndex]);
+                    totalHW += deltaHW > 0.0f ? deltaHW : 0.0f;
+                }
+                if constexpr (Thermal) {
+                    const float deltaH = cellHeight - heightIn[nCellIndex];
+                    const bool interior = !Edge || ((z + dZ > 0) & (z + dZ < depth - 1) & (x + dX > 0) & (x + dX < width - 1));
+                    totalH += interior & (deltaH > kT) ? deltaH : 0.0f;
+                }
+            });
+            if constexpr (Hydraulic)
+                totalDeltaHW[cellIndex] = totalHW;
+            if constexpr (Thermal)
+                totalDeltaH[cellIndex] = totalH;
+        }
+    }
+
+    void hydraulicRow(int z, int width, float kC, float kS, float kD,
+        const float* __restrict heightIn, const float* __restrict waterIn, const float* __restrict sedimentIn,
+        const float* __restrict totalDeltaHW,
+        float* __restrict heightOut, float* __restrict waterOut, float* __restrict sedimentOut) {
+        #pragma omp simd
+        for (int x = 1; x < width - 1; x++) {
+            const int cellIndex = z * width + x;
+            const float cellHeight = heightIn[cellIndex];
+            const float cellWater = waterIn[cellIndex];
+            const float cellSediment = sedimentIn[cellIndex];
+            const float cellTotalHW = totalDeltaHW[cellIndex];
+            const bool wet = cellWater != 0.0f;
+
+            float cellTotalDeltaH = 0.0f;
+            float cellTotalDeltaS = 0.0f;
+            float cellTotalDeltaW = 0.0f;
+            forNeighbours([&](int dX, int dZ) {
+                const int nCellIndex = cellIndex + dZ * width + dX;
+                const float nHeight = heightIn[nCellIndex];
+                const float nWater = waterIn[nCellIndex];
+                const float deltaH = (cellHeight + cellWater) - (nHeight + nWater);
+
+                // flow out of this cell, dry cells move nothing
+                const float outW = cellWater < deltaH ? cellWater : deltaH;
+                const bool deposit = wet & (outW <= 0.0f) & (cellHeight <= nHeight);
+                const bool outflow = wet & (outW > 0.0f);
+                const float outFlow = outW * (deltaH / cellTotalHW);
+                const float outS = cellSediment * (deltaH / cellTotalHW);
+                const float outCap = outFlow * kC;
+                const bool outDeposits = outS >= outCap;
+                const float outDeposit = kD * (outS - outCap);
+                const float sedDeposit = kD * cellSediment;
+
+                cellTotalDeltaH += deposit ? sedDeposit : 0.0f;
+                cellTotalDeltaS -= deposit ? sedDeposit : 0.0f;
+                cellTotalDeltaW -= outflow ? outFlow : 0.0f;
+                cellTotalDeltaS -= outflow ? (outDeposits ? outCap + outDeposit : outS) : 0.0f;
+                cellTotalDeltaH += outflow ? (outDeposits ? outDeposit : -kS * (outCap - outS)) : 0.0f;
+
+                // flow in from the neighbour, as it would have scattered it
+                const float inH = -deltaH;
+                const float inW = nWater < inH ? nWater : inH;
+                // neighbour loads are used by every lane so they are not sunk in to a branch, masked off lanes are kept finite
+                const float nTotalHW = totalDeltaHW[nCellIndex];
+                const float inScale = inH / (nTotalHW > 1e-20f ? nTotalHW : 1e-20f);
+                const float inMask = (nWater != 0.0f) & (inW > 0.0f) ? 1.0f : 0.0f;
+                const float inFlow = inW * inScale;
+                const float inS = sedimentIn[nCellIndex] * inScale;
+                const float inCap = inFlow * kC;
+                cellTotalDeltaW += inMask * inFlow;
+                cellTotalDeltaS += inMask * (inS >= inCap ? inCap : inS + kS * (inCap - inS));
+            });
+            heightOut[cellIndex] += cellTotalDeltaH;
+            sedimentOut[cellIndex] += cellTotalDeltaS;
+            waterOut[cellIndex] += cellTotalDeltaW;
+        }
+    }
+
+    template <bool Edge>
+    void thermalGatherCells(int z, int x0, int x1, int width, int depth, float kT, float cT,
+        const float* __restrict heightIn, const float* __restrict totalDeltaH, float* __restrict heightOut) {
+        #pragma omp simd
+        for (int x = x0; x < x1; x++) {
+            const int cellIndex = z * width + x;
+            const float cellHeight = heightIn[cellIndex];
+            const float cellTotalH = totalDeltaH[cellIndex];
+            float cellTotalDeltaH = 0.0f;
+            forNeighbours([&](int dX, int dZ) {
+                const int nCellIndex = cellIndex + dZ * width + dX;
+                const bool interior = !Edge || ((z + dZ > 0) & (z + dZ < depth - 1) & (x + dX > 0) & (x + dX < width - 1));
+                // material slides in from higher neighbours and out to lower ones
+                const float deltaH = heightIn[nCellIndex] - cellHeight;
+                const float slideIn = cT * (deltaH - kT) * (deltaH / totalDeltaH[nCellIndex]);
+                const float slideOut = cT * (-deltaH - kT) * (-deltaH / cellTotalH);
+                cellTotalDeltaH += interior & (deltaH > kT) ? slideIn : 0.0f;
+                cellTotalDeltaH -= interior & (-deltaH > kT) ? slideOut : 0.0f;
+            });
+            heightOut[cellIndex] += cellTotalDeltaH;
+        }
+    }
+
+    template <bool Hydraulic, bool Thermal>
+    void gatherTotals(const ErosionGrid& grid, const ErosionParams& params, float* totalDeltaHW, float* totalDeltaH,
+        int z0, int z1) {
+        TaskScheduler::get().parallelFor(z0, z1, [&](int z) {
+            forRowRuns(z, grid.width, grid.depth, [&](auto edge, int x0, int x1) {
+                totalsCells<Hydraulic, Thermal, decltype(edge)::value>(z, x0, x1, grid.width, grid.depth, params.kT,
+                    grid.heightIn, grid.waterIn, totalDeltaHW, totalDeltaH);
+            });
+        });
+    }
+
+    template <bool Hydraulic, bool Thermal, bool Rain>
+    struct GatherStep {
+        static void run(const ErosionGrid& grid, const ErosionParams& params, int step, float* totalDeltaHW, float* totalDeltaH) {
+            if constexpr (Rain) {
+                if (step % params.rainFrequency == 0)
+                    distributeRainCPU(grid, params);
+            }
+            if constexpr (Hydraulic || Thermal)
+                gatherTotals<Hydraulic, Thermal>(grid, params, totalDeltaHW, totalDeltaH, 1, grid.depth - 1);
+            if constexpr (Hydraulic)
+                hydraulicErosionGatherCPU(grid, params, totalDeltaHW);
+            if constexpr (Thermal)
+                thermalErosionGatherCPU(grid, params, totalDeltaH);
+            updateBuffersCPU(grid, params);
+        }
+    };
+}
+
+void erosionTotalsCPU(const ErosionGrid& grid, const ErosionParams& params, float* totalDeltaHW, float* totalDeltaH) {
+    gatherTotals<true, true>(grid, params, totalDeltaHW, totalDeltaH, 1, grid.depth - 1);
+}
+
+namespace {
+    void hydraulicGatherRows(const ErosionGrid& grid, const ErosionParams& params, const float* totalDeltaHW,
+        int z0, int z1) {
+        // water reaches border cells, so no cell needs a boundary check
+        TaskScheduler::get().parallelFor(z0, z1, [&](int z) {
+            hydraulicRow(z, grid.width, params.kC, params.kS, params.kD, grid.heightIn, grid.waterIn, grid.sedimentIn,
+                totalDeltaHW, grid.heightOut, grid.waterOut, grid.sedimentOut);
+        });
+    }
+}
+
+void hydraulicErosionGatherCPU(const ErosionGrid& grid, const ErosionParams& params, const float* totalDeltaHW) {
+    hydraulicGatherRows(grid, params, totalDeltaHW, 1, grid.depth - 1);
+}
+
+namespace {
+    void thermalGatherRows(const ErosionGrid& grid, const ErosionParams& params, const float* totalDeltaH,
+        int z0, int z1) {
+        TaskScheduler::get().parallelFor(z0, z1, [&](int z) {
+            forRowRuns(z, grid.width, grid.depth, [&](auto edge, int x0, int x1) {
+                thermalGatherCells<decltype(edge)::value>(z, x0, x1, grid.width, grid.depth, params.kT, params.cT,
+                    grid.heightIn, totalDeltaH, grid.heightOut);
+            });
+        });
+    }
+}
+
+void thermalErosionGatherCPU(const ErosionGrid& grid, const ErosionParams& params, const float* totalDeltaH) {
+    thermalGatherRows(grid, params, totalDeltaH, 1, grid.depth - 1);
+}
+
+void erosionStepGatherCPU(const ErosionGrid& grid, const ErosionParams& params, int step, float* totalDeltaHW, float* totalDeltaH) {
+    narrowestStep<GatherStep>(params)(grid, params, step, totalDeltaHW, totalDeltaH);
+}
+
+bool ErosionStepSlicer::passEnabled(int p) const {
+    const bool gather = totalDeltaHW != nullptr;
+    switch (p) {
+    case RAIN:
+        return stepParams.hydraulicEnabled && stepParams.rainFrequency != 0 && step % stepParams.rainFrequency == 0;
+    case TOTALS:
+        return gather && (stepParams.hydraulicEnabled || stepParams.thermalEnabled);
+    case HYDRAULIC:
+        return stepParams.hydraulicEnabled;
+    case THERMAL:
+        return stepParams.thermalEnabled;
+    default:
+        return true;
+    }
+}
+
+void ErosionStepSlicer::runPass(const ErosionGrid& grid, int z0, int z1) {
+    const bool gather = totalDeltaHW != nullptr;
+    switch (pass) {
+    case RAIN:
+        distributeRainRows(grid, stepParams, z0, z1);
+        break;
+    case TOTALS:
+        if (stepParams.hydraulicEnabled && stepParams.thermalEnabled)
+            gatherTotals<true, true>(grid, stepParams, totalDeltaHW, totalDeltaH, z0, z1);
+        else if (stepParams.hydraulicEnabled)
+            gatherTotals<true, false>(grid, stepParams, totalDeltaHW, totalDeltaH, z0, z1);
+        else
+            gatherTotals<false, true>(grid, stepParams, totalDeltaHW, totalDeltaH, z0, z1);
+        break;
+    case HYDRAULIC:
+        if (gather)
+            hydraulicGatherRows(grid, stepParams, totalDeltaHW, z0, z1);
+        else
+            hydraulicScatterRows(grid, stepParams, z0, z1);
+        break;
+    case THERMAL:
+        if (gather)
+            thermalGatherRows(grid, stepParams, totalDeltaH, z0, z1);
+        else
+            thermalScatterRows(grid, stepParams, z0, z1);
+        break;
+    default:
+        updateBuffersRows(grid, stepParams, z0, z1);
+        break;
+    }
+}
+
+bool ErosionStepSlicer::run(const ErosionGrid& grid, const ErosionParams& params, int step_, int& rows,
+    float* totalDeltaHW_, float* totalDeltaH_) {
+    // a new step takes the parameters of its first slice, they may change between slices but not within a step
+    if (pass == IDLE) {
+        stepParams = params;
+        step = step_;
+        totalDeltaHW = totalDeltaHW_;
+        totalDeltaH = totalDeltaH_;
+        pass = RAIN;
+        row = 1;
+        if (!passEnabled(pass))
+            nextPass();
+    }
+
+    while (rows > 0 && pass != IDLE) {
+        const int end = std::min(row + std::min(rows, grid.depth), grid.depth - 1);
+        if (end > row) {
+            runPass(grid, row, end);
+            rows -= end - row;
+            row = end;
+        }
+        if (row >= grid.depth - 1)
+            nextPass();
+    }
+    return pass == IDLE;
+}
+
+void ErosionStepSlicer::nextPass() {
+    row = 1;
+    do {
+        pass++;
+    } while (pass != IDLE && !passEnabled(pass));
+}
+
+bool erodeRegionCPU(float* heights, float* water, int width, int depth, const ErosionParams& params, int nSteps,
+    const std::atomic<bool>* running) {
+    const int size = width * depth;
+    std::vector<float> heightOut(heights, heights + size);
+    std::vector<float> waterOut(size, 0.0f);
+    std::vector<float> sedimentIn(size, 0.0f);
+    std::vector<float> sedimentOut(size, 0.0f);
+    std::fill(water, water + size, 0.0f);
+
+    const ErosionGrid grid{ heights, heightOut.data(), water, waterOut.data(),
+        sedimentIn.data(), sedimentOut.data(), width, depth };
+    seedWaterCPU(grid, params);
+    for (int step = 0; step < nSteps; step++) {
+        if (running && !*running)
+            return false;
+        erosionStepCPU(grid, params, step);
+    }
+    return true;
+}
+
+namespace {
+    // weight of a tile covering [begin, end) of an axis of length n at cell i
+    // ramps cross the middle of the overlap so neighbouring tiles sum to one and tile edges get no weight
+    float tileWeight(int i, int begin, int end, int n, int overlap) {
+        const float half = overlap * 0.5f;
+        float weight = 1.0f;
+        if (begin > 0)
+            weight *= std::clamp((i - (begin - half) + 0.5f) / overlap, 0.0f, 1.0f);
+        if (end < n)
+            weight *= 1.0f - std::clamp((i - (end - half) + 0.5f) / overlap, 0.0f, 1.0f);
+        return weight;
+    }
+}
+
+bool erodeTiledCPU(const float* heightsIn, float* heightsOut, float* waterOut, int width, int depth,
+    const ErosionParams& params, int nSteps, int tileSize, int overlap,
+    const std::atomic<bool>* running, std::atomic<int>* tilesDone) {
+    // ramps must not overlap each other within a tile, and need at least two cells
+    overlap = std::max(overlap, 2);
+    tileSize = std::max(tileSize, overlap);
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesZ = (depth + tileSize - 1) / tileSize;
+    const int nTiles = tilesX * tilesZ;
+
+    std::fill(heightsOut, heightsOut + width * depth, 0.0f);
+    std::fill(waterOut, waterOut + width * depth, 0.0f);
+
+    TaskScheduler::get().parallelFor(0, nTiles, [&](int tile) {
+        if (running && !*running)
+            return;
+
+        // core cells of this tile and the extended region eroded around it
+        const int coreX0 = (tile % tilesX) * tileSize;
+        const int coreZ0 = (tile / tilesX) * tileSize;
+        const int coreX1 = std::min(coreX0 + tileSize, width);
+        const int coreZ1 = std::min(coreZ0 + tileSize, depth);
+        const int x0 = std::max(coreX0 - overlap, 0);
+        const int z0 = std::max(coreZ0 - overlap, 0);
+        const int tileWidth = std::min(coreX1 + overlap, width) - x0;
+        const int tileDepth = std::min(coreZ1 + overlap, depth) - z0;
+
+        // tile buffers are reused by each thread, kernels inside the tile run on this thread so nothing else touches them
+        thread_local std::vector<float> tileHeights;
+        thread_local std::vector<float> tileWater;
+        tileHeights.resize(tileWidth * tileDepth);
+        tileWater.resize(tileWidth * tileDepth);
+        for (int z = 0; z < tileDepth; z++) {
+            std::copy_n(&heightsIn[(z0 + z) * width + x0], tileWidth, &tileHeights[z * tileWidth]);
+        }
+
+        if (!erodeRegionCPU(tileHeights.data(), tileWater.data(), tileWidth, tileDepth, params, nSteps, running))
+            return;
+
+        // accumulate weighted results, only cells within the overlaps are shared with other tiles
+        for (int z = 0; z < tileDepth; z++) {
+            const float weightZ = tileWeight(z0 + z, coreZ0, coreZ1, depth, overlap);
+            if (weightZ == 0.0f)
+                continue;
+            for (int x = 0; x < tileWidth; x++) {
+                const float weight = weightZ * tileWeight(x0 + x, coreX0, coreX1, width, overlap);
+                if (weight == 0.0f)
+                    continue;
+                const int cellIndex = (z0 + z) * width + x0 + x;
+                atomicAdd(heightsOut[cellIndex], weight * tileHeights[z * tileWidth + x]);
+                atomicAdd(waterOut[cellIndex], weight * tileWater[z * tileWidth + x]);
+            }
+        }
+        if (tilesDone)
+            (*tilesDone)++;
+    });
+    return !running || *running;
+}
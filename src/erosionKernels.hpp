@@ -0,0 +1,95 @@
+#ifndef EROSION_KERNELS_HPP_INCLUDED
+#define EROSION_KERNELS_HPP_INCLUDED
+
+#include "dirtyTiles.hpp"
+
+#include <atomic>
+
+// erosion parameters, copied from ErosionManager when a run starts
+struct ErosionParams {
+    bool hydraulicEnabled = true;
+    float kC = 0.75f; // SEDIMENT CAPACITY
+    float kD = 0.015f; // DEPOSITION RATE
+    float kS = 0.15f; // DISSOLVING RATE
+    float kE = 1.0f; // EVAPORATION RATE
+    float rain = 0.150f;
+    int rainFrequency = 0;
+    bool thermalEnabled = true;
+    float kT = 0.6f; // GLOBAL TALUS ANGLE
+    float cT = 0.05f; // THERMAL WEATHERING RATE
+    float maxHeight = 1.0f; // rain is scaled by height relative to this
+    // tiled erosion
+    int tileSize = 256;
+    int tileOverlap = 32; // cells of context eroded around each tile
+};
+
+// the buffers a CPU erosion step reads and writes, rows of width cells
+// border cells are never updated
+struct ErosionGrid {
+    float* heightIn = nullptr;
+    float* heightOut = nullptr;
+    float* waterIn = nullptr;
+    float* waterOut = nullptr;
+    float* sedimentIn = nullptr;
+    float* sedimentOut = nullptr;
+    int width = 0;
+    int depth = 0;
+    DirtyTiles* dirty = nullptr; // if set, tiles whose height or water changed are marked each step
+};
+
+// CPU erosion kernels
+void seedWaterCPU(const ErosionGrid&, const ErosionParams&);
+void distributeRainCPU(const ErosionGrid&, const ErosionParams&);
+void hydraulicErosionCPU(const ErosionGrid&, const ErosionParams&);
+void thermalErosionCPU(const ErosionGrid&, const ErosionParams&);
+void updateBuffersCPU(const ErosionGrid&, const ErosionParams&);
+// steps run the instantiation specialised on the enabled features, looked up each step as parameters can change mid run
+void erosionStepCPU(const ErosionGrid&, const ErosionParams&, int step);
+
+// gather form of a step, as the GPU runs it, each cell sums the flows in and out of itself only
+// from per cell totals of positive height differences, so no atomics are needed and the row loops vectorise
+// totals are scratch grids of the same size, their border cells must be zero
+void erosionTotalsCPU(const ErosionGrid&, const ErosionParams&, float* totalDeltaHW, float* totalDeltaH);
+void hydraulicErosionGatherCPU(const ErosionGrid&, const ErosionParams&, const float* totalDeltaHW);
+void thermalErosionGatherCPU(const ErosionGrid&, const ErosionParams&, const float* totalDeltaH);
+void erosionStepGatherCPU(const ErosionGrid&, const ErosionParams&, int step, float* totalDeltaHW, float* totalDeltaH);
+
+// one step run a number of rows at a time, so a step longer than a caller can wait for is spread over several calls
+// passes run in the same order as a whole step and each covers every row before the next starts, so a step ends
+// exactly as one run whole would, the grids are only consistent once it is complete
+class ErosionStepSlicer {
+private:
+    enum Pass { RAIN, TOTALS, HYDRAULIC, THERMAL, UPDATE, IDLE };
+
+    int pass = IDLE;
+    int row = 1;
+    int step = 0;
+    ErosionParams stepParams;
+    float* totalDeltaHW = nullptr;
+    float* totalDeltaH = nullptr;
+
+    bool passEnabled(int) const;
+    void runPass(const ErosionGrid&, int z0, int z1);
+    void nextPass();
+public:
+    // runs up to rows rows of passes, starting a step if none is part way, and takes the rows run off rows
+    // totals select the gather kernels as in erosionStepGatherCPU, the scatter kernels are run without them
+    // returns true once the step is complete
+    bool run(const ErosionGrid&, const ErosionParams&, int step, int& rows,
+        float* totalDeltaHW = nullptr, float* totalDeltaH = nullptr);
+    inline bool midStep() const { return pass != IDLE; }
+    inline void reset() { pass = IDLE; }
+};
+
+// erodes a standalone region in place with its own buffers
+// stops early and returns false once running is cleared
+bool erodeRegionCPU(float* heights, float* water, int width, int depth, const ErosionParams&, int nSteps,
+    const std::atomic<bool>* running = nullptr);
+
+// erodes a grid as independent tiles of tileSize cells run in parallel, each with overlap cells of context on every side
+// tiles are cross-faded across the middle of the overlaps so only one tile's worth of buffers is held per thread
+bool erodeTiledCPU(const float* heightsIn, float* heightsOut, float* waterOut, int width, int depth,
+    const ErosionParams&, int nSteps, int tileSize, int overlap,
+    const std::atomic<bool>* running = nullptr, std::atomic<int>* tilesDone = nullptr);
+
+#endif
@@ -1,10 +1,10 @@
 #include "erosionManager.hpp"
 #include "terrain.hpp"
+#include "taskScheduler.hpp"
 
-#include <glad/glad.h>
-#include <omp.h>
 #include <future>
 #include <algorithm>
+#include <chrono>
 
 #define heightIn terrain->heightmap
 #define waterIn terrain->water
@@ -13,51 +13,13 @@ void ErosionManager::init(Terrain* terrain_) {
     terrain = terrain_;
     width = terrain->width;
     size = width * width;
-
-    // compile compute shaders
-    erosionShader = new ShaderProgram(std::vector<Shader>{
-        {"res/shaders/erosion.comp", GL_COMPUTE_SHADER}});
-    bufferUpdateShader = new ShaderProgram(std::vector<Shader>{
-        {"res/shaders/erosionUpdate.comp", GL_COMPUTE_SHADER}});
-    updateDeltaHShader = new ShaderProgram(std::vector<Shader>{
-        {"res/shaders/erosionDeltaH.comp", GL_COMPUTE_SHADER}});
-
-    // create CPU erosion buffers
-    heightOut = std::vector<float>(size);
-    sedimentIn = std::vector<float>(size);
-    heightOut = std::vector<float>(size);
-    sedimentOut = std::vector<float>(size);
-    waterOut = std::vector<float>(size);
-
-    // create GPU erosion buffers
-    glGenBuffers(1, &heightInSSBO);   glGenBuffers(1, &heightOutSSBO);
-    glGenBuffers(1, &waterInSSBO);     glGenBuffers(1, &waterOutSSBO);
-    glGenBuffers(1, &sedimentInSSBO);  glGenBuffers(1, &sedimentOutSSBO);
-    glGenBuffers(1, &totalDeltaHSSBO); glGenBuffers(1, &totalDeltaHWSSBO);
-
-    // fill buffers
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, heightOutSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), NULL, GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, waterOutSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), NULL, GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sedimentInSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), NULL, GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sedimentOutSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), NULL, GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, totalDeltaHSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), NULL, GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, totalDeltaHWSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), NULL, GL_DYNAMIC_COPY);
-
-    // bind SSBOs
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, heightInSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, heightOutSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, waterInSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, waterOutSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, sedimentInSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, sedimentOutSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, totalDeltaHWSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, totalDeltaHSSBO);
+    step = 0;
+    resumable = false;
+    cooperativeRun = false;
+    dirtyTiles.resize(width, width);
+    // bound to the grids of the last heightmap
+    backend.reset();
+    backendInfo = nullptr;
 }
 
 float ErosionManager::calculateScore() {
@@ -66,9 +28,9 @@ float ErosionManager::calculateScore() {
     long double totalVariance = 0.0;
     float mean, std;
     
-    // calculate slope map
-    #pragma omp parallel for
-    for (unsigned int z = 2; z < width - 2; z++) {
+    // calculate slope map, summed per row and reduced once the loop is done
+    std::vector<long double> rowTotals(width, 0.0);
+    TaskScheduler::get().parallelFor(2, (int)width - 2, [&](int z) {
         for (unsigned int x = 2; x < width - 2; x++) {
             // get maximum height difference between neighbours, Von Neumann neighbourhood
             float cellHeight = heightIn[z * width + x];
@@ -78,8 +40,11 @@ float ErosionManager::calculateScore() {
                 std::fabs(cellHeight - heightIn[z * width + x + 1]),
                 std::fabs(cellHeight - heightIn[z * width + x - 1])
                 });
-            totalHeight += slopeMap[z * width + x];
+            rowTotals[z] += slopeMap[z * width + x];
         }
+    });
+    for (long double rowTotal : rowTotals) {
+        totalHeight += rowTotal;
     }
     mean = totalHeight / (long double)(size);
     
@@ -94,325 +59,326 @@ float ErosionManager::calculateScore() {
     return std / mean;
 }
 
-void ErosionManager::startErosion(ErosionBackend backend) {
+ErosionParams ErosionManager::getParams() const {
+    ErosionParams params;
+    params.hydraulicEnabled = hydraulicEnabled;
+    params.kC = kC;
+    params.kD = kD;
+    params.kS = kS;
+    params.kE = kE;
+    params.rain = rain;
+    params.rainFrequency = rainFrequency;
+    params.thermalEnabled = thermalEnabled;
+    params.kT = kT;
+    params.cT = cT;
+    params.maxHeight = terrain ? terrain->maxHeight : 1.0f;
+    params.tileSize = tileSize;
+    params.tileOverlap = tileOverlap;
+    return params;
+}
+
+void ErosionManager::startErosion(int steps) {
+    // a live run is stopped first, waiting on it could block on a mesh upload only this thread can do
+    if (eroding)
+        stopErosion();
+    // a run that has just finished may still be returning
+    if (erosionFutureCPU.valid())
+        erosionFutureCPU.wait();
+
+    // backends hold state sized to the terrain, so one is only kept while the terrain and selection are unchanged
+    const ErosionBackendInfo* info = findErosionBackend(backendName);
+    if (!info)
+        return;
+    if (!backend || info != backendInfo) {
+        backend = info->create();
+        backend->init(heightIn.data(), waterIn.data(), width, width, &dirtyTiles);
+        backendInfo = info;
+    }
+
     step = 0;
+    targetStep = steps;
     eroding = true;
-    if (backend == ErosionBackend::CPU) {
-        erosionFutureCPU = std::async(std::launch::async, &ErosionManager::erosionPipelineCPU, this);
-    }
-    else if (backend == ErosionBackend::GPU) {
-        erosionPipelineGPU();
-    }
+    paused = false;
+    erosionIdleTime = 0.0f;
+    mesherIdleTime = 0.0f;
+    backend->resetStats();
+    // only progressive backends leave their water and sediment where the next run can pick them up
+    resumable = backend->progressive();
+    // non progressive backends do the whole run in one call, so can't be sliced between frames
+    cooperativeRun = cooperative && backend->progressive();
+    if (cooperativeRun)
+        startCooperative(false);
+    else if (backend->needsGL())
+        erosionPipelineGPU(false);
+    else if (backend->progressive())
+        erosionFutureCPU = TaskScheduler::get().submit([this] { erosionPipelineCPU(false); }, TaskScheduler::NORMAL);
+    else
+        erosionFutureCPU = TaskScheduler::get().submit([this] { erosionPipelineWholeCPU(); }, TaskScheduler::NORMAL);
 }
 
 void ErosionManager::stopErosion() {
     eroding = false;
+    // a cooperative run just stops being stepped, a GL backend's state is read back so the terrain shows the steps it ran
+    if (cooperativeRun) {
+        backend->setQueueing(false);
+        if (backend->needsGL()) {
+            backend->readState();
+            terrain->generateMesh(true);
+        }
+        cooperativeRun = false;
+    }
+    // release a thread paused or waiting on an upload that will not come
+    pauseSignal.notify();
+    if (terrain)
+        terrain->meshHandoff.notify();
     if (erosionFutureCPU.valid()) {
         erosionFutureCPU.wait();
     }
+    paused = false;
+}
+
+void ErosionManager::pauseErosion() {
+    // GPU runs finish within the frame they were started in, unless stepped cooperatively
+    if (eroding && backend->progressive() && (cooperativeRun || !backend->needsGL()))
+        paused = true;
+}
+
+void ErosionManager::resumeErosion() {
+    paused = false;
+    pauseSignal.notify();
+}
+
+void ErosionManager::continueErosion(int extraSteps) {
+    // a running progressive run is extended, otherwise the last one carries on from its state without reseeding
+    if (eroding) {
+        if (backend->progressive())
+            targetStep += extraSteps;
+        return;
+    }
+    // a different backend can't pick up this one's water and sediment, so starts a fresh run
+    if (!resumable || !backend || findErosionBackend(backendName) != backendInfo) {
+        startErosion(extraSteps);
+        return;
+    }
+    if (erosionFutureCPU.valid())
+        erosionFutureCPU.wait();
+
+    targetStep = step + extraSteps;
+    eroding = true;
+    paused = false;
+    cooperativeRun = cooperative;
+    if (cooperativeRun)
+        startCooperative(true);
+    else if (backend->needsGL())
+        erosionPipelineGPU(true);
+    else
+        erosionFutureCPU = TaskScheduler::get().submit([this] { erosionPipelineCPU(true); }, TaskScheduler::NORMAL);
 }
 
 void ErosionManager::clean() {
-    glDeleteBuffers(1, &heightInSSBO);
-    glDeleteBuffers(1, &heightOutSSBO);
-    glDeleteBuffers(1, &waterInSSBO);
-    glDeleteBuffers(1, &waterOutSSBO);
-    glDeleteBuffers(1, &sedimentInSSBO);
-    glDeleteBuffers(1, &sedimentOutSSBO);
-    glDeleteBuffers(1, &totalDeltaHWSSBO);
-    glDeleteBuffers(1, &totalDeltaHSSBO);
-
-    bufferUpdateShader->clean();
-    updateDeltaHShader->clean();
-    bufferUpdateShader->clean();
+    // nothing to release if never initialised
+    if (!terrain)
+        return;
+
+    // GL backends release their buffers here, while the context is current
+    cooperativeRun = false;
+    backend.reset();
+    backendInfo = nullptr;
+    terrain = nullptr;
 }
 
 // CPU EROSION --------------------------------------------------------------------
-void ErosionManager::erosionPipelineCPU() {
-    // fill data grids
-    #pragma omp parallel for
-    for (int z = 1; z < width - 1; z++) {
-        for (int x = 1; x < width - 1; x++) {
-            const int cellIndex = z * width + x;
-            waterIn[cellIndex] = rain * (heightIn[cellIndex] / terrain->maxHeight);
-            sedimentIn[cellIndex] = 0.0f;
-
-            waterOut[cellIndex] = waterIn[cellIndex];
-            sedimentOut[cellIndex] = 0.0f;
-            heightOut[cellIndex] = heightIn[cellIndex];
+void ErosionManager::erosionPipelineCPU(bool resume) {
+    // a resumed run carries on from the water and sediment left by the last one
+    if (!resume)
+        backend->seed(getParams());
+    // seeding covers the whole terrain with water, and a resumed run's mesher starts from nothing
+    dirtyTiles.markAll();
+
+    snapshots.resize(width, width);
+    meshing = true;
+    mesher = std::thread(&ErosionManager::meshSnapshots, this);
+
+    while (eroding && step < targetStep) {
+        // steps only finish whole, so the buffers always hold a consistent state while paused
+        if (paused) {
+            pauseSignal.wait([this] { return !paused || !eroding; });
+            continue;
         }
-    }
 
-    while (eroding && step < nSteps) {
-        // perform hydraulic erosion
-        if (hydraulicEnabled) {
-            // distribute water if it is time to rain
-            if (rainFrequency) {
-                if (step % rainFrequency == 0) {
-                    distributeRainCPU();
-                }
-            }
-            hydraulicErosionCPU();
-        }
-        // Thermal Weathering
-        if (thermalEnabled)
-            thermalErosionCPU();
-
-        // use output array as input for next step
-        #pragma omp parallel for
-        for (int z = 1; z < width - 1; z++) {
-            for (int x = 1; x < width - 1; x++) {
-                const int cellIndex = z * width + x;
-
-                // apply evaporation if any
-                waterOut[cellIndex] *= kE;
-                if (waterOut[cellIndex] < 0.000001f) {
-                    heightOut[cellIndex] += sedimentIn[cellIndex];
-                    sedimentOut[cellIndex] = 0.0f;
-                    waterOut[cellIndex] = 0.0f;
-                }
-
-                heightIn[cellIndex] = heightOut[cellIndex];
-                waterIn[cellIndex] = waterOut[cellIndex];
-                sedimentIn[cellIndex] = sedimentOut[cellIndex];
-            }
-        }
+        // parameters are fetched every step so they can be tweaked while eroding
+        if (backend->step(1, getParams(), &eroding) == 0)
+            break;
 
-        #pragma omp atomic
         step++;
 
-        // generate mesh if needed
-        if (terrain->showErosion && !terrain->needMeshSentGPU()) {
-            terrain->generateMesh(terrain->showWater);
+        // hand the state to the mesher, only once it has taken the last snapshot so erosion never waits on it
+        if (terrain->showErosion) {
+            snapshots.markDirty(dirtyTiles);
+            dirtyTiles.clear();
+            if (snapshots.canPublish()) {
+                snapshots.publish(heightIn.data(), waterIn.data());
+                terrain->meshHandoff.notify();
+            }
         }
     }
 
+    meshing = false;
+    terrain->meshHandoff.notify();
+    mesher.join();
+
     // wait for any previous mesh upload to complete
     if (eroding) {
-        while (terrain->needMeshSentGPU()) {}
+        waitForMeshSent();
         // generate terrain + water mesh
-        terrain->generateMesh(true);
+        if (eroding)
+            terrain->generateMesh(true);
     }
 
     eroding = false;
 }
 
-void ErosionManager::distributeRainCPU() {
-    #pragma omp parallel for
-    for (int z = 1; z < width - 1; z++) {
-        for (int x = 1; x < width - 1; x++) {
-            const int cellIndex = (z * width) + x;
-            waterIn[cellIndex] += rain * (heightIn[cellIndex] / terrain->maxHeight);
-            waterOut[cellIndex] = waterIn[cellIndex];
-        }
+void ErosionManager::meshSnapshots() {
+    while (true) {
+        // sleep until there is a new snapshot and the last mesh has been uploaded, it is not replaced before then
+        mesherIdleTime = mesherIdleTime + (float)terrain->meshHandoff.wait([this] {
+            return !meshing || (snapshots.hasSnapshot() && !terrain->needMeshSentGPU());
+        });
+        if (!meshing)
+            return;
+        const SnapshotBuffer::Snapshot* snapshot = snapshots.take();
+        terrain->generateMesh(snapshot->heights.data(), snapshot->water.data(), terrain->showWater, &snapshot->dirty);
     }
 }
 
-void ErosionManager::hydraulicErosionCPU() {
-    int neighbours[8];
-    float neighboursDeltaH[8];
-    
-    static constexpr int dX[8] = { -1, +0, +1, -1, +1, -1, +0, +1 };
-    static constexpr int dZ[8] = { -1, -1, -1, +0, +0, +1, +1, +1 };
+void ErosionManager::waitForMeshSent() {
+    // blocks until the render thread has uploaded the last mesh, or erosion is stopped
+    erosionIdleTime = erosionIdleTime + (float)terrain->meshHandoff.wait([this] {
+        return !terrain->needMeshSentGPU() || !eroding;
+    });
+}
 
-    #pragma omp parallel for schedule(dynamic) private(neighbours, neighboursDeltaH)
-    for (int z = 1; z < width - 1; z++) {
-        for (int x = 1; x < width - 1; x++) {
-            const int cellIndex = (z * width) + x;
+void ErosionManager::erosionPipelineWholeCPU() {
+    // the grids are only consistent once the whole run is done, e.g. tiles all read the uneroded heightmap,
+    // so progress is shown from the backend rather than the mesh
+    backend->seed(getParams());
+    const int steps = targetStep;
+    if (backend->step(steps, getParams(), &eroding) == steps) {
+        step = steps;
+        waitForMeshSent();
+        if (eroding)
+            terrain->generateMesh(true);
+    }
 
-            // skip if no water in current cell
-            if (waterIn[cellIndex] == 0.0f)
-                continue;
+    eroding = false;
+}
+// END CPU EROSION ----------------------------------------------------------------
 
-            // grab neighbours
-            float totalDeltaH = 0.0f;
+// GPU EROSION --------------------------------------------------------------------
+void ErosionManager::erosionPipelineGPU(bool resume) {
+    // runs on the render thread, which owns the context
+    if (!resume)
+        backend->seed(getParams());
+    step += backend->step(targetStep - step, getParams(), &eroding);
 
-            for (int i = 0; i < 8; i++) {
-                const int nCellIndex = ((z + dZ[i]) * width) + (x + dX[i]);
-                // get total difference in height (inc. water)
-                const float deltaH = (heightIn[cellIndex] + waterIn[cellIndex]) -
-                    (heightIn[nCellIndex] + waterIn[nCellIndex]);
+    // fetch data from GPU
+    // only required data is the heightmap and water values
+    backend->readState();
+    terrain->generateMesh(true);
+    eroding = false;
+}
+// END GPU EROSION ----------------------------------------------------------------
 
-                if (deltaH > 0.0f) {
-                    totalDeltaH += deltaH;
-                }
+// COOPERATIVE EROSION ------------------------------------------------------------
+void ErosionManager::startCooperative(bool resume) {
+    // runs on the render thread, so GL backends can be stepped too
+    if (!resume)
+        backend->seed(getParams());
+    dirtyTiles.markAll();
+    backend->setQueueing(true);
+    queuedSteps = 1;
+    stepSeconds = 0.0;
+    rowSeconds = 0.0;
+    meshSeconds = 0.0;
+}
 
-                neighboursDeltaH[i] = deltaH;
-                neighbours[i] = nCellIndex;
-            }
+void ErosionManager::update() {
+    if (!cooperativeRun || paused)
+        return;
+    if (step >= targetStep) {
+        finishCooperative();
+        return;
+    }
 
-            float cellTotalDeltaH = 0.0f;
-            float cellTotalDeltaS = 0.0f;
-            float cellTotalDeltaW = 0.0f;
-
-            // for each neighbour calculate flow of water and sediment
-            for (int n = 0; n < 8; n++) {
-                const int nCellIndex = neighbours[n];
-                const float deltaH = neighboursDeltaH[n];
-
-                // try to move all the excess water out of the cell
-                float deltaW = std::min(waterIn[cellIndex], deltaH);
-
-                // neighbour total height (inc water) is higher than current cell
-                if (deltaW <= 0.0f) {
-                    // deposit some sediment at current cell if altitude is lower
-                    if (heightIn[cellIndex] <= heightIn[nCellIndex]) {
-                        const float sedDeposit = kD * sedimentIn[cellIndex];
-                        cellTotalDeltaH += sedDeposit;
-                        cellTotalDeltaS -= sedDeposit;
-                    }
-                }
-
-                // neighbour total height (inc. water) is lower than current cell
-                else {
-                    // calculate movement of water from current cell to neighbour
-                    // scale water to move by difference in heights
-                    deltaW = deltaW * (deltaH / totalDeltaH);
-                    #pragma omp atomic
-                    waterOut[nCellIndex] += deltaW;
-                    cellTotalDeltaW -= deltaW;
-
-                    // sediment trying to move from cell to neighbour
-                    const float deltaS = sedimentIn[cellIndex] * (deltaH / totalDeltaH);
-                    // calculate max amount of sediment able to be carried in water at current cell
-                    const float sCap = deltaW * kC;
-                    if (deltaS >= sCap) { // deposition
-                        // move max amount of sediment in to neighbouring cell
-                        #pragma omp atomic
-                        sedimentOut[nCellIndex] += sCap;
-                        // deposit left over sediment in current cell
-                        const float sedimentToDeposit = kD * (deltaS - sCap);
-                        cellTotalDeltaS -= sedimentToDeposit + sCap;
-                        cellTotalDeltaH += sedimentToDeposit;
-                    }
-                    else { // erosion
-                        const float erosionAmount = kS * (sCap - deltaS);
-                        cellTotalDeltaH -= erosionAmount;
-                        cellTotalDeltaS -= deltaS;
-                        #pragma omp atomic
-                        sedimentOut[nCellIndex] += deltaS + erosionAmount;
-                    }
-                }
-            }
-            #pragma omp atomic
-            heightOut[cellIndex] += cellTotalDeltaH;
-            #pragma omp atomic
-            sedimentOut[cellIndex] += cellTotalDeltaS;
-            #pragma omp atomic
-            waterOut[cellIndex] += cellTotalDeltaW;
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    const auto secondsSince = [](Clock::time_point from) {
+        return std::chrono::duration<double>(Clock::now() - from).count();
+    };
+    const double budget = frameBudget / 1000.0;
+    const ErosionParams params = getParams();
+
+    if (backend->canQueue()) {
+        // a batch a frame, grown while each is done by the next frame and halved while the device falls behind
+        if (!backend->idle()) {
+            queuedSteps = std::max(queuedSteps / 2, 1);
+            return;
         }
+        step += backend->step(std::min(queuedSteps, targetStep - step), params, &eroding);
+        queuedSteps++;
     }
-
-}
-
-void ErosionManager::thermalErosionCPU() {
-    static constexpr int dX[8] = { -1, +0, +1, -1, +1, -1, +0, +1 };
-    static constexpr int dZ[8] = { -1, -1, -1, +0, +0, +1, +1, +1 };
-    
-    float neighboursDeltaH[8];
-    int neighbours[8];
-
-    #pragma omp parallel for schedule(dynamic) private(neighbours, neighboursDeltaH)
-    for (int z = 1; z < width - 1; z++) {
-        for (int x = 1; x < width - 1; x++) {
-            float cellTotalDeltaH = 0.0f;
-            const int cellIndex = z * width + x;
-
-            // get neighbours
-            float totalDeltaH = 0.0f;
-            int totalLowerNeighbours = 0;
-            for (int i = 0; i < 8; i++) {
-                // check if neighbour is not a boundary
-                if (z + dZ[i] > 0 && z + dZ[i] < width - 1 &&
-                    x + dX[i] > 0 && x + dX[i] < width - 1) {
-
-                    const int nCellIndex = ((z + dZ[i]) * width) + (x + dX[i]);
-
-                    // get difference in height 
-                    const float deltaH = heightIn[cellIndex] - heightIn[nCellIndex];
-                    if (deltaH > kT) {
-                        totalDeltaH += deltaH;
-                        neighboursDeltaH[totalLowerNeighbours] = deltaH;
-                        neighbours[totalLowerNeighbours] = nCellIndex;
-                        totalLowerNeighbours++;
-                    }
-                }
-            }
-
-            for (int i = 0; i < totalLowerNeighbours; i++) {
-                const float deltaH = cT * (neighboursDeltaH[i] - kT) * (neighboursDeltaH[i] / totalDeltaH);
-                cellTotalDeltaH -= deltaH;
-                #pragma omp atomic
-                heightOut[neighbours[i]] += deltaH;
-            }
-            #pragma omp atomic
-            heightOut[cellIndex] += cellTotalDeltaH;
+    else if (backend->sliceable()) {
+        // as many rows of passes as fit in what is left of the budget, carrying on through steps, so a step
+        // taking longer than the budget is spread over frames rather than overrunning every one of them
+        const int stepBefore = step;
+        do {
+            const double left = budget - secondsSince(start) - meshSeconds;
+            const int rows = rowSeconds > 0.0 ? (int)std::clamp(left / rowSeconds, (double)MIN_SLICE_ROWS, 1e8) : MIN_SLICE_ROWS;
+            const Clock::time_point sliceStart = Clock::now();
+            step += backend->stepRows(rows, targetStep - step, params);
+            rowSeconds = secondsSince(sliceStart) / rows;
+        } while (eroding && step < targetStep && secondsSince(start) + MIN_SLICE_ROWS * rowSeconds + meshSeconds < budget);
+
+        // the mesh is only rebuilt on frames that finished a step, rows of the next may already be a step ahead
+        if (step != stepBefore && terrain->showErosion && !terrain->needMeshSentGPU()) {
+            const Clock::time_point meshStart = Clock::now();
+            terrain->generateMesh(heightIn.data(), waterIn.data(), terrain->showWater, &dirtyTiles);
+            dirtyTiles.clear();
+            meshSeconds = secondsSince(meshStart);
         }
     }
-}
-// END CPU EROSION ----------------------------------------------------------------
-
-// GPU EROSION --------------------------------------------------------------------
-void ErosionManager::erosionPipelineGPU() {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, heightInSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), heightIn.data(), GL_DYNAMIC_COPY);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, waterInSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), waterIn.data(), GL_DYNAMIC_COPY);
-
-    // send uniforms
-    // Main erosion shader
-    glUseProgram(erosionShader->glID);
-
-    glUniform1i(0, width);
-    glUniform1i(1, hydraulicEnabled);
-    glUniform1f(2, kC);
-    glUniform1f(3, kD);
-    glUniform1f(4, kS);
-    glUniform1f(5, kE);
-    glUniform1i(6, thermalEnabled);
-    glUniform1f(7, kT);
-    glUniform1f(8, cT);
-
-    // buffer update shader
-    glUseProgram(bufferUpdateShader->glID);
-    glUniform1i(0, width);
-    glUniform1f(1, terrain->maxHeight);
-    glUniform1f(3, rain);
-    glUniform1i(4, rainFrequency);
-    glUniform1f(5, kE);
-
-    // deltaH shader, for neighbour heights
-    glUseProgram(updateDeltaHShader->glID);
-    glUniform1i(0, width);
-    glUniform1i(1, kT);
-
-    // dispatch the compute shader and await results
-    for (step = 0; step < nSteps; step++) {
-        // update buffers
-        glUseProgram(bufferUpdateShader->glID);
-        glUniform1i(2, step);
-        glDispatchCompute(width / WORKGROUP_SIZE, width / WORKGROUP_SIZE, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-        // calculate new deltaH values
-        glUseProgram(updateDeltaHShader->glID);
-        glDispatchCompute(width / WORKGROUP_SIZE, width / WORKGROUP_SIZE, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-        // run simulation on buffers
-        glUseProgram(erosionShader->glID);
-        glDispatchCompute(width / WORKGROUP_SIZE, width / WORKGROUP_SIZE, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    else {
+        // as many steps as fit in what is left of the budget, at least one a frame so the run always moves on
+        do {
+            const double left = budget - secondsSince(start) - meshSeconds;
+            const int n = stepSeconds > 0.0 ? std::clamp((int)(left / stepSeconds), 1, targetStep - step) : 1;
+            const Clock::time_point stepStart = Clock::now();
+            const int done = backend->step(n, params, &eroding);
+            if (done == 0)
+                break;
+            stepSeconds = secondsSince(stepStart) / done;
+            step += done;
+        } while (step < targetStep && secondsSince(start) + stepSeconds + meshSeconds < budget);
+
+        // the mesh follows on the same thread once the last one has been uploaded, GL backends only show the result
+        if (terrain->showErosion && !backend->needsGL() && !terrain->needMeshSentGPU()) {
+            const Clock::time_point meshStart = Clock::now();
+            terrain->generateMesh(heightIn.data(), waterIn.data(), terrain->showWater, &dirtyTiles);
+            dirtyTiles.clear();
+            meshSeconds = secondsSince(meshStart);
+        }
     }
 
-    // fetch data from GPU
-    // only required data is the heightmap and water values
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, heightInSSBO);
-    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size * sizeof(float), heightIn.data());
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, waterInSSBO);
-    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size * sizeof(float), waterIn.data());
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (step >= targetStep)
+        finishCooperative();
+}
 
-    glUseProgram(0);
+void ErosionManager::finishCooperative() {
+    // reading back waits on any steps still queued
+    backend->setQueueing(false);
+    backend->readState();
+    terrain->generateMesh(true);
+    cooperativeRun = false;
+    eroding = false;
 }
-// END GPU EROSION ----------------------------------------------------------------
+// END COOPERATIVE EROSION --------------------------------------------------------
\ No newline at end of file
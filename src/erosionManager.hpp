@@ -1,54 +1,54 @@
 #ifndef EROSION_MANAGER_HPP_INCLUDED
 #define EROSION_MANAGER_HPP_INCLUDED
 
-#include "shaderProgram.hpp"
+#include "erosionKernels.hpp"
+#include "erosionBackend.hpp"
+#include "snapshotBuffer.hpp"
+#include "signal.hpp"
 
 #include <memory>
 #include <atomic>
 #include <vector>
 #include <cmath>
 #include <future>
+#include <thread>
+#include <string>
 
 class Terrain;
 
-enum class ErosionBackend {
-    CPU, GPU
-};
-
 class ErosionManager {
 private:
-    constexpr static unsigned int WORKGROUP_SIZE = 32;
     std::future<void> erosionFutureCPU;
+    Signal pauseSignal;
     Terrain* terrain = nullptr;
 
-    ShaderProgram* bufferUpdateShader;
-    ShaderProgram* updateDeltaHShader;
-    ShaderProgram* erosionShader;
-
-    // CPU erosion buffers
-    std::vector<float> heightOut;
-    std::vector<float> waterOut;
-    std::vector<float> sedimentIn;
-    std::vector<float> sedimentOut;
+    // created on the first run after the terrain or selected backend changes, eroding the terrain's grids in place
+    std::unique_ptr<ErosionBackend> backend;
+    const ErosionBackendInfo* backendInfo = nullptr;
+    DirtyTiles dirtyTiles; // changed since the last step was handed to the mesher
 
-    // GPU erosion buffers
-    unsigned int heightInSSBO = NULL;
-    unsigned int heightOutSSBO = NULL;
-    unsigned int waterInSSBO = NULL;
-    unsigned int waterOutSSBO = NULL;
-    unsigned int sedimentInSSBO = NULL;
-    unsigned int sedimentOutSSBO = NULL;
-    unsigned int totalDeltaHWSSBO = NULL;
-    unsigned int totalDeltaHSSBO = NULL;
+    // meshes are built from snapshots on their own thread so erosion never waits on them
+    // it mostly blocks on the handoff so keeps its own thread rather than holding a scheduler worker, its loops still run on the scheduler
+    SnapshotBuffer snapshots;
+    std::thread mesher;
+    std::atomic<bool> meshing = false;
 
-    // CPU erosion functions
-    void erosionPipelineCPU();
-    void distributeRainCPU();
-    void hydraulicErosionCPU();
-    void thermalErosionCPU();
+    // cooperative runs are stepped from update on the render thread rather than on their own thread
+    constexpr static int MIN_SLICE_ROWS = 16; // rows of passes run a frame at least, so the run always moves on
+    bool cooperativeRun = false;
+    int queuedSteps = 1; // steps queued a frame on backends that don't block, grown while they keep up
+    double stepSeconds = 0.0; // last measured, for fitting steps in to what is left of a frame's budget
+    double rowSeconds = 0.0; // the same per row of a pass, for backends stepped a slice of rows at a time
+    double meshSeconds = 0.0;
 
-    // GPU erosion functions
-    void erosionPipelineGPU();
+    // progressive backends are stepped one at a time so the mesh can follow, others run the whole way in one call
+    void erosionPipelineCPU(bool resume);
+    void erosionPipelineWholeCPU();
+    void erosionPipelineGPU(bool resume);
+    void startCooperative(bool resume);
+    void finishCooperative();
+    void meshSnapshots();
+    void waitForMeshSent();
 public:
     // Erosion parameters
     int nSteps = 2500; // NUMBER OF ITERATIONS
@@ -64,9 +64,23 @@ public:
     bool thermalEnabled = true;
     float kT = 0.6f; // GLOBAL TALUS ANGLE
     float cT = 0.05f; // THERMAL WEATHERING RATE
+    // Tiled Erosion
+    int tileSize = 256;
+    int tileOverlap = 32; // cells of context eroded around each tile
 
-    bool eroding = false;
-    int step = 0;
+    std::atomic<bool> eroding = false;
+    std::atomic<bool> paused = false;
+    std::atomic<int> step = 0; // read by the render thread while a run steps on the scheduler
+    std::atomic<int> targetStep = 0; // progressive runs stop once step reaches this
+    bool resumable = false; // water and sediment of the last run are still held by the backend
+    std::string backendName = "cpu"; // registered name of the backend the next run uses
+    // runs erosion in slices of a frame's budget between frames, so the UI keeps its rate on machines with few cores
+    bool cooperative = false;
+    float frameBudget = 8.0f; // ms a frame spends eroding in cooperative runs
+
+    // seconds the erosion and mesher threads spent blocked in the last run
+    std::atomic<float> erosionIdleTime = 0.0f;
+    std::atomic<float> mesherIdleTime = 0.0f;
 
     unsigned int width = 0;
     unsigned int size = 0;
@@ -76,9 +90,18 @@ public:
 	void init(Terrain* terrain_);
     void clean();
     float calculateScore();
+    ErosionParams getParams() const;
     
-    void startErosion(ErosionBackend backend);
+    void startErosion(int steps);
     void stopErosion();
+    // advances a cooperative run, called once a frame on the render thread
+    void update();
+    inline const ErosionBackend* getBackend() const { return backend.get(); }
+
+    // progressive backends only, state is kept between steps so a run can be paused or extended
+    void pauseErosion();
+    void resumeErosion();
+    void continueErosion(int extraSteps);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "erosionTuning.hpp"
+#include "taskScheduler.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <thread>
+
+std::string erosionTuning::path() {
+#if defined(_WIN32)
+    const char* base = std::getenv("APPDATA");
+    return std::string(base ? base : ".") + "\\FractalErode\\erosion_tuning.cfg";
+#else
+    const char* xdg = std::getenv("XDG_CONFIG_HOME");
+    const char* home = std::getenv("HOME");
+    const std::string base = xdg && *xdg ? xdg : (home ? std::string(home) + "/.config" : ".");
+    return base + "/FractalErode/erosion_tuning.cfg";
+#endif
+}
+
+std::string erosionTuning::machine() {
+    std::string cpu;
+#if defined(_WIN32)
+    if (const char* identifier = std::getenv("PROCESSOR_IDENTIFIER"))
+        cpu = identifier;
+#elif defined(__linux__)
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.rfind("model name", 0) == 0) {
+            const size_t start = line.find_first_not_of(' ', line.find(':') + 1);
+            if (start != std::string::npos)
+                cpu = line.substr(start);
+            break;
+        }
+    }
+#endif
+    return std::to_string(std::thread::hardware_concurrency()) + " threads " + cpu;
+}
+
+bool erosionTuning::load(ErosionTuning& tuning) {
+    std::ifstream file(path());
+    if (!file)
+        return false;
+
+    // key=value lines, anything unknown is skipped so older files still load
+    ErosionTuning loaded;
+    bool sameMachine = false;
+    std::string line;
+    while (std::getline(file, line)) {
+        const size_t equals = line.find('=');
+        if (line.empty() || line[0] == '#' || equals == std::string::npos)
+            continue;
+        const std::string key = line.substr(0, equals);
+        const std::string value = line.substr(equals + 1);
+        if (key == "machine")
+            sameMachine = value == machine();
+        else if (key == "backend")
+            loaded.backend = value;
+        else if (key == "threads")
+            loaded.threads = std::atoi(value.c_str());
+        else if (key == "chunksPerThread")
+            loaded.chunksPerThread = std::atoi(value.c_str());
+        else if (key == "msPerStep")
+            loaded.msPerStep = std::atof(value.c_str());
+    }
+    if (!sameMachine)
+        return false;
+    tuning = loaded;
+    return true;
+}
+
+bool erosionTuning::save(const ErosionTuning& tuning) {
+    const std::filesystem::path file = path();
+    std::error_code error;
+    std::filesystem::create_directories(file.parent_path(), error);
+
+    std::ofstream out(file);
+    if (!out)
+        return false;
+    out << "# erosion configuration found by FractalErode --autotune, delete to go back to the defaults\n";
+    out << "machine=" << machine() << "\n";
+    out << "backend=" << tuning.backend << "\n";
+    out << "threads=" << tuning.threads << "\n";
+    out << "chunksPerThread=" << tuning.chunksPerThread << "\n";
+    out << "msPerStep=" << tuning.msPerStep << "\n";
+    return (bool)out;
+}
+
+void erosionTuning::apply(const ErosionTuning& tuning) {
+    TaskScheduler::get().setThreadBudget(tuning.threads);
+    TaskScheduler::get().setChunksPerThread(tuning.chunksPerThread);
+}
@@ -0,0 +1,26 @@
+#ifndef EROSION_TUNING_HPP_INCLUDED
+#define EROSION_TUNING_HPP_INCLUDED
+
+#include <string>
+
+// fastest erosion configuration the autotuner found on this machine, loaded automatically on later runs
+struct ErosionTuning {
+    std::string backend = "cpu";
+    int threads = 1; // scheduler thread budget
+    int chunksPerThread = 4;
+    double msPerStep = 0.0;
+};
+
+namespace erosionTuning {
+    // per user config file under the platform's config directory
+    std::string path();
+    // the hardware a tuning was found on, tunings from other machines sharing a home directory are ignored
+    std::string machine();
+
+    bool load(ErosionTuning&);
+    bool save(const ErosionTuning&);
+    // sets up the task scheduler, the backend is applied to the erosion manager by the caller
+    void apply(const ErosionTuning&);
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include "gpuErosionBackend.hpp"
+
+#include <glad/glad.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+GPUErosionBackend::~GPUErosionBackend() {
+    release();
+}
+
+void GPUErosionBackend::release() {
+    glDeleteSync((GLsync)fence);
+    fence = nullptr;
+    glDeleteBuffers(1, &heightInSSBO);
+    glDeleteBuffers(1, &heightOutSSBO);
+    glDeleteBuffers(1, &waterInSSBO);
+    glDeleteBuffers(1, &waterOutSSBO);
+    glDeleteBuffers(1, &sedimentInSSBO);
+    glDeleteBuffers(1, &sedimentOutSSBO);
+    glDeleteBuffers(1, &totalDeltaHWSSBO);
+    glDeleteBuffers(1, &totalDeltaHSSBO);
+    heightInSSBO = heightOutSSBO = 0;
+    waterInSSBO = waterOutSSBO = 0;
+    sedimentInSSBO = sedimentOutSSBO = 0;
+    totalDeltaHWSSBO = totalDeltaHSSBO = 0;
+
+    // shader programs delete themselves on destruction
+    bufferUpdateShader.reset();
+    updateDeltaHShader.reset();
+    erosionShader.reset();
+}
+
+void GPUErosionBackend::init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_) {
+    ErosionBackend::init(heights_, water_, width_, depth_, dirty_);
+    release();
+    activeRows = depth;
+
+    // compile compute shaders
+    erosionShader = std::make_unique<ShaderProgram>(std::vector<Shader>{
+        {"res/shaders/erosion.comp", GL_COMPUTE_SHADER}});
+    bufferUpdateShader = std::make_unique<ShaderProgram>(std::vector<Shader>{
+        {"res/shaders/erosionUpdate.comp", GL_COMPUTE_SHADER}});
+    updateDeltaHShader = std::make_unique<ShaderProgram>(std::vector<Shader>{
+        {"res/shaders/erosionDeltaH.comp", GL_COMPUTE_SHADER}});
+
+    // create and size buffers, filled when a run is seeded and by its first step
+    const size_t bytes = (size_t)width * depth * sizeof(float);
+    unsigned int* buffers[] = { &heightInSSBO, &heightOutSSBO, &waterInSSBO, &waterOutSSBO,
+        &sedimentInSSBO, &sedimentOutSSBO, &totalDeltaHWSSBO, &totalDeltaHSSBO };
+    for (unsigned int* buffer : buffers) {
+        glGenBuffers(1, buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, NULL, GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GPUErosionBackend::bindBuffers() {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, heightInSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, heightOutSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, waterInSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, waterOutSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, sedimentInSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, sedimentOutSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, totalDeltaHWSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, totalDeltaHSSBO);
+}
+
+void GPUErosionBackend::seed(const ErosionParams&) {
+    // the update shader seeds water on step 0 but never writes border cells, so both copies start from the grids
+    const size_t bytes = (size_t)width * depth * sizeof(float);
+    const std::pair<unsigned int, const float*> uploads[] = { { heightInSSBO, heights }, { heightOutSSBO, heights },
+        { waterInSSBO, water }, { waterOutSSBO, water } };
+    for (const auto& upload : uploads) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, upload.first);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, upload.second);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    stepsRun = 0;
+}
+
+int GPUErosionBackend::runSteps(int n, const ErosionParams& params, const std::atomic<bool>* running) {
+    bindBuffers();
+
+    // send uniforms
+    // Main erosion shader
+    glUseProgram(erosionShader->glID);
+    glUniform1i(0, width);
+    glUniform1i(1, params.hydraulicEnabled);
+    glUniform1f(2, params.kC);
+    glUniform1f(3, params.kD);
+    glUniform1f(4, params.kS);
+    glUniform1f(5, params.kE);
+    glUniform1i(6, params.thermalEnabled);
+    glUniform1f(7, params.kT);
+    glUniform1f(8, params.cT);
+
+    // buffer update shader
+    glUseProgram(bufferUpdateShader->glID);
+    glUniform1i(0, width);
+    glUniform1f(1, params.maxHeight);
+    glUniform1f(3, params.rain);
+    glUniform1i(4, params.rainFrequency);
+    glUniform1f(5, params.kE);
+
+    // deltaH shader, for neighbour heights
+    glUseProgram(updateDeltaHShader->glID);
+    glUniform1i(0, width);
+    glUniform1f(1, params.kT);
+
+    const unsigned int groupsX = width / WORKGROUP_SIZE;
+    const unsigned int groupsZ = (activeRows + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    int done = 0;
+    for (; done < n && (!running || *running); done++) {
+        // update buffers
+        glUseProgram(bufferUpdateShader->glID);
+        glUniform1i(2, stepsRun++);
+        glDispatchCompute(groupsX, groupsZ, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // calculate new deltaH values
+        glUseProgram(updateDeltaHShader->glID);
+        glDispatchCompute(groupsX, groupsZ, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // run simulation on buffers
+        glUseProgram(erosionShader->glID);
+        glDispatchCompute(groupsX, groupsZ, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    glUseProgram(0);
+
+    if (queueing) {
+        // flushed with a fence so idle can tell when they are done without stalling the frame
+        glDeleteSync((GLsync)fence);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+    else {
+        // wait for the dispatches so the time spent is measured rather than the time to queue them
+        glFinish();
+    }
+    return done;
+}
+
+bool GPUErosionBackend::idle() {
+    if (!fence)
+        return true;
+    const GLenum status = glClientWaitSync((GLsync)fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    glDeleteSync((GLsync)fence);
+    fence = nullptr;
+    return true;
+}
+
+void GPUErosionBackend::readState() {
+    // the grids are already current until a step has run
+    if (stepsRun == 0)
+        return;
+
+    // the last step's results are in the out buffers, copied back to the in buffers at the start of the next one
+    const size_t bytes = (size_t)width * depth * sizeof(float);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, heightOutSSBO);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, heights);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, waterOutSSBO);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, water);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (dirty)
+        dirty->markAll();
+}
+
+void GPUErosionBackend::setActiveRows(int rows) {
+    activeRows = std::clamp(rows, 0, depth);
+}
+
+void GPUErosionBackend::readRows(int z0, int z1, float* heights_, float* water_, float* sediment) {
+    if (z1 <= z0)
+        return;
+    const size_t offset = (size_t)z0 * width * sizeof(float);
+    const size_t bytes = (size_t)(z1 - z0) * width * sizeof(float);
+    const std::pair<unsigned int, float*> reads[] = { { heightOutSSBO, heights_ }, { waterOutSSBO, water_ },
+        { sedimentOutSSBO, sediment } };
+    for (const auto& read : reads) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, read.first);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, bytes, read.second);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GPUErosionBackend::writeRows(int z0, int z1, const float* heights_, const float* water_, const float* sediment) {
+    if (z1 <= z0)
+        return;
+    const size_t offset = (size_t)z0 * width * sizeof(float);
+    const size_t bytes = (size_t)(z1 - z0) * width * sizeof(float);
+    const std::pair<unsigned int, const float*> writes[] = { { heightInSSBO, heights_ }, { heightOutSSBO, heights_ },
+        { waterInSSBO, water_ }, { waterOutSSBO, water_ }, { sedimentInSSBO, sediment }, { sedimentOutSSBO, sediment } };
+    for (const auto& write : writes) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, write.first);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, bytes, write.second);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
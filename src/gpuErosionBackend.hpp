@@ -0,0 +1,58 @@
+#ifndef GPU_EROSION_BACKEND_HPP_INCLUDED
+#define GPU_EROSION_BACKEND_HPP_INCLUDED
+
+#include "erosionBackend.hpp"
+#include "shaderProgram.hpp"
+
+#include <memory>
+
+// erosion on compute shaders, the state lives in storage buffers and is only read back on request
+// needs a current GL context, so it is created, run and destroyed on the render thread
+class GPUErosionBackend : public ErosionBackend {
+private:
+    constexpr static unsigned int WORKGROUP_SIZE = 32;
+
+    std::unique_ptr<ShaderProgram> bufferUpdateShader;
+    std::unique_ptr<ShaderProgram> updateDeltaHShader;
+    std::unique_ptr<ShaderProgram> erosionShader;
+
+    unsigned int heightInSSBO = 0;
+    unsigned int heightOutSSBO = 0;
+    unsigned int waterInSSBO = 0;
+    unsigned int waterOutSSBO = 0;
+    unsigned int sedimentInSSBO = 0;
+    unsigned int sedimentOutSSBO = 0;
+    unsigned int totalDeltaHWSSBO = 0;
+    unsigned int totalDeltaHSSBO = 0;
+    int activeRows = 0; // rows from the top that are stepped, the first row past them is held fixed
+    bool queueing = false;
+    void* fence = nullptr; // GLsync after the last queued steps, opaque so glad stays out of the header
+
+    void bindBuffers();
+    void release();
+protected:
+    int runSteps(int n, const ErosionParams&, const std::atomic<bool>* running) override;
+public:
+    GPUErosionBackend() = default;
+    GPUErosionBackend(const GPUErosionBackend&) = delete;
+    ~GPUErosionBackend();
+
+    void init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_) override;
+    void seed(const ErosionParams&) override;
+    void readState() override;
+
+    bool needsGL() const override { return true; }
+    bool canQueue() const override { return true; }
+    void setQueueing(bool queueing_) override { queueing = queueing_; }
+    bool idle() override;
+
+    // for eroding only a band of the grid here, rows [0, rows) are stepped, rounded up to whole workgroups
+    void setActiveRows(int rows);
+    inline int getActiveRows() const { return activeRows; }
+    // copy rows [z0, z1) of the latest state, before evaporation, to or from arrays holding just those rows
+    // written rows go to both copies, so rows past the active ones that are never stepped still read them
+    void readRows(int z0, int z1, float* heights_, float* water_, float* sediment);
+    void writeRows(int z0, int z1, const float* heights_, const float* water_, const float* sediment);
+};
+
+#endif
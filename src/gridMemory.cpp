@@ -0,0 +1,120 @@
+#include "gridMemory.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <string>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
+#endif
+
+namespace {
+    // grids smaller than this are left to the heap, placement only pays off across many pages
+    constexpr size_t MAPPED_MIN_BYTES = 1 << 20;
+    constexpr size_t HUGE_PAGE_BYTES = 2 << 20;
+    constexpr int MPOL_INTERLEAVE = 3; // from linux/mempolicy.h, which is not always installed
+
+    std::atomic<bool> interleave = false;
+    std::atomic<bool> hugePages = false;
+
+    size_t mappedBytes(size_t bytes) {
+        // rounded up to whole huge pages so the whole grid can be promoted, pages never touched cost nothing
+        // this must not depend on the options, which may change before the grid is released
+        return (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    }
+}
+
+void gridMemory::setOptions(const GridMemoryOptions& options) {
+    // only grids allocated afterwards are affected
+    interleave = options.interleave;
+    hugePages = options.hugePages;
+}
+
+GridMemoryOptions gridMemory::getOptions() {
+    GridMemoryOptions options;
+    options.interleave = interleave;
+    options.hugePages = hugePages;
+    return options;
+}
+
+int gridMemory::nodeCount() {
+    static const int nodes = [] {
+#if defined(_WIN32)
+        ULONG highestNode = 0;
+        return GetNumaHighestNodeNumber(&highestNode) ? (int)highestNode + 1 : 1;
+#elif defined(__linux__)
+        // online nodes are listed as ranges, e.g. "0-1"
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string ranges;
+        if (!(online >> ranges))
+            return 1;
+        const size_t dash = ranges.find_last_of("-,");
+        return std::atoi(ranges.c_str() + (dash == std::string::npos ? 0 : dash + 1)) + 1;
+#else
+        return 1;
+#endif
+    }();
+    return nodes;
+}
+
+void* gridMemory::allocate(size_t bytes) {
+    if (bytes < MAPPED_MIN_BYTES)
+        return ::operator new(bytes, std::nothrow);
+
+#if defined(_WIN32)
+    // large pages need the lock pages privilege, fall back to normal pages without it
+    if (hugePages) {
+        const size_t largePage = GetLargePageMinimum();
+        if (largePage > 0) {
+            const size_t largeBytes = (bytes + largePage - 1) / largePage * largePage;
+            void* memory = VirtualAlloc(nullptr, largeBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (memory)
+                return memory;
+        }
+    }
+    // interleaving has no direct equivalent, pages are placed by first touch
+    return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+    const size_t length = mappedBytes(bytes);
+    void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+    if (hugePages)
+        madvise(memory, length, MADV_HUGEPAGE);
+    if (interleave && nodeCount() > 1) {
+        // policies only apply to pages not yet faulted in, which is all of them
+        unsigned long nodeMask[4] = {};
+        const int nodes = std::min(nodeCount(), (int)(sizeof(nodeMask) * 8));
+        for (int node = 0; node < nodes; node++) {
+            nodeMask[node / 64] |= 1ul << (node % 64);
+        }
+        syscall(SYS_mbind, memory, length, MPOL_INTERLEAVE, nodeMask, sizeof(nodeMask) * 8, 0);
+    }
+    return memory;
+#else
+    return ::operator new(bytes, std::nothrow);
+#endif
+}
+
+void gridMemory::release(void* memory, size_t bytes) {
+    if (!memory)
+        return;
+    if (bytes < MAPPED_MIN_BYTES) {
+        ::operator delete(memory);
+        return;
+    }
+
+#if defined(_WIN32)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(__linux__)
+    munmap(memory, mappedBytes(bytes));
+#else
+    ::operator delete(memory);
+#endif
+}
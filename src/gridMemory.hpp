@@ -0,0 +1,87 @@
+#ifndef GRID_MEMORY_HPP_INCLUDED
+#define GRID_MEMORY_HPP_INCLUDED
+
+#include "taskScheduler.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// placement of the large per cell grids the kernels stream through
+// pages are not touched on allocation, so they land on the NUMA node of the first thread to write them
+struct GridMemoryOptions {
+    bool interleave = false; // spread pages round robin over every node instead of first touch
+    bool hugePages = false; // back grids with huge pages where the OS allows it
+};
+
+namespace gridMemory {
+    void setOptions(const GridMemoryOptions&);
+    GridMemoryOptions getOptions();
+    int nodeCount();
+
+    void* allocate(size_t bytes);
+    void release(void* memory, size_t bytes);
+}
+
+// vector allocator that leaves default constructed elements uninitialised, pages are first touched by resizeGrid
+template <class T>
+struct GridAllocator {
+    using value_type = T;
+
+    GridAllocator() = default;
+    template <class U>
+    GridAllocator(const GridAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* memory = gridMemory::allocate(n * sizeof(T));
+        if (!memory)
+            throw std::bad_alloc();
+        return (T*)memory;
+    }
+    void deallocate(T* memory, size_t n) { gridMemory::release(memory, n * sizeof(T)); }
+
+    template <class U>
+    void construct(U* p) { ::new((void*)p) U; }
+    template <class U, class... Args>
+    void construct(U* p, Args&&... args) { ::new((void*)p) U(std::forward<Args>(args)...); }
+
+    template <class U>
+    bool operator==(const GridAllocator<U>&) const { return true; }
+    template <class U>
+    bool operator!=(const GridAllocator<U>&) const { return false; }
+};
+
+template <class T>
+using Grid = std::vector<T, GridAllocator<T>>;
+
+// reallocates a grid of rows of rowLength elements, filling it with the same row partitioning as the kernels
+// so each row's pages are placed near the threads that go on to work on it
+template <class T>
+void resizeGrid(Grid<T>& grid, size_t count, int rowLength, const T& value = T()) {
+    Grid<T>(count).swap(grid);
+    const int rows = (int)((count + rowLength - 1) / rowLength);
+    T* data = grid.data();
+    TaskScheduler::get().parallelFor(0, rows, [&](int row) {
+        const size_t begin = (size_t)row * rowLength;
+        const size_t end = std::min(begin + rowLength, count);
+        for (size_t i = begin; i < end; i++) {
+            data[i] = value;
+        }
+    });
+}
+
+// parallel copy in to a grid already sized by resizeGrid
+template <class T>
+void copyGrid(const T* source, Grid<T>& grid, int rowLength) {
+    const size_t count = grid.size();
+    const int rows = (int)((count + rowLength - 1) / rowLength);
+    T* data = grid.data();
+    TaskScheduler::get().parallelFor(0, rows, [&](int row) {
+        const size_t begin = (size_t)row * rowLength;
+        std::copy(source + begin, source + std::min(begin + rowLength, count), data + begin);
+    });
+}
+
+#endif
@@ -1,7 +1,8 @@
 #include "heightMesh.hpp"
 #include "vec3.hpp"
+#include "taskScheduler.hpp"
 #include <glad/glad.h>
-#include <omp.h>
+#include <algorithm>
 
 HeightMesh::HeightMesh(float* verts, float _cellSize, int _xWidth, int _zWidth){
     cellSize = _cellSize;
@@ -13,161 +14,170 @@ HeightMesh::~HeightMesh() {
 	clean();
 }
 
-void HeightMesh::init(float _cellSize, int _xWidth, int _zWidth) {
+void HeightMesh::init(float _cellSize, int _xWidth, int _zWidth, int halo_, int uploadSlots_) {
     cellSize = _cellSize;
     xWidth = _xWidth;
     zWidth = _zWidth;
+    halo = halo_;
+    uploadSlots = uploadSlots_;
 }
 
-void HeightMesh::generate(float* hmap) {
+void HeightMesh::quantise(float minHeight, float maxHeight) {
+    // every copy encoded with a different range has to be rewritten
+    if (generated && (!quantised || minHeight != heightMin || maxHeight != heightMax)) {
+        for (DirtyTiles& copyDirty : slotDirty) {
+            copyDirty.markAll();
+        }
+        stagedDirty.markAll();
+        gpuDirty.markAll();
+    }
+    quantised = true;
+    heightMin = minHeight;
+    heightMax = maxHeight;
+}
+
+void HeightMesh::generate(const float* hmap, const DirtyTiles* dirty) {
     if (needSendGPU) {
         needSendGPU = false;
     }
 
     if (!generated) {
-        numIndices = (xWidth - 1) * (zWidth - 1) * 6;
-
-        heights = new float[xWidth * zWidth];
-        normals = new Vec3[xWidth * zWidth];
-        indices = new uint32_t[numIndices];
-
-        // create faces with indices
-#pragma omp parallel for
-        for (int z = 0; z < zWidth - 1; z++) {
-            for (int x = 0; x < xWidth - 1; x++) {
-                const int index = ((z * (xWidth - 1)) + x) * 6;
-                indices[index] = (z * xWidth) + x;
-                indices[index + 1] = ((z + 1) * xWidth) + x;
-                indices[index + 2] = ((z + 1) * xWidth) + x + 1;
-                indices[index + 3] = (z * xWidth) + x;
-                indices[index + 4] = ((z + 1) * xWidth) + x + 1;
-                indices[index + 5] = (z * xWidth) + x + 1;
-            }
-        }
+        heights = new float[heightCount()];
 
-        // iterate though vertices
-#pragma omp parallel for
-        for (int z = 0; z < zWidth; z++) {
-            for (int x = 0; x < xWidth; x++) {
-                const int index = z * xWidth + x;
-                // set height according to heightmap elevation
-                heights[index] = hmap[index];
-                // set normals as zero for now
-                normals[index].x = 0.0f;
-                normals[index].y = 0.0f;
-                normals[index].z = 0.0f;
-            }
-        }
-    }
-    else {
-        // iterate though vertices, only set the updated y position this time
-#pragma omp parallel for
-        for (int z = 0; z < zWidth; z++) {
-            for (int x = 0; x < xWidth; x++) {
-                const int index = z * xWidth + x;
-                // set vertice positions according to heightmap elevation
-                heights[index] = hmap[index];
-                // set normals as zero for now
-                normals[index].x = 0.0f;
-                normals[index].y = 0.0f;
-                normals[index].z = 0.0f;
-            }
+        for (DirtyTiles& copyDirty : slotDirty) {
+            copyDirty.resize(xWidth, zWidth);
         }
+        stagedDirty.resize(xWidth, zWidth);
+        gpuDirty.resize(xWidth, zWidth);
+        dirty = nullptr;
     }
 
-    // generate smooth normals per 2-face cells
-#pragma omp parallel for
-    for (int z = 1; z < zWidth - 2; z ++) {
-        for (int x = 1; x < xWidth - 2; x ++) {
-            const int index = ((z * (xWidth - 1)) + x) * 6;
-            const int in0 = indices[index]; // x,z
-            const int in1 = indices[index + 1]; // x,z+1
-            const int in2 = indices[index + 2]; // x+1,z+1
-            const int in3 = indices[index + 5]; // x+1,z
-
-            const Vec3 v0{ x, heights[z * xWidth + x], z };
-            const Vec3 v1{ x, heights[(z+1) * xWidth + x], z+1 };
-            const Vec3 v2{ x+1, heights[(z+1) * xWidth + x+1], z+1 };
-            const Vec3 v3{ x+1, heights[z * xWidth + x+1], z };
-
-            const Vec3 normal1 = cross(v1 - v0, v2 - v0);
-            const Vec3 normal2 = cross(v2 - v0, v3 - v0);
-            const Vec3 normal3 = normal1 + normal2;
-
-            // Data race
-            // not urgent to fix as normal precision is not essential
-            normals[in0] += normal3;
-            normals[in1] += normal1;
-            normals[in2] += normal3;
-            normals[in3] += normal2;
-        }
+    // every copy falls behind by the changed tiles, or entirely without dirty tracking
+    auto fallBehind = [dirty](DirtyTiles& copyDirty) {
+        if (dirty)
+            copyDirty.merge(*dirty);
+        else
+            copyDirty.markAll();
+    };
+    for (DirtyTiles& copyDirty : slotDirty) {
+        fallBehind(copyDirty);
     }
+    fallBehind(stagedDirty);
+    fallBehind(gpuDirty);
+
+    // copy heights in to mapped GPU memory when a slot is free
+    int slotIndex = -1;
+    void* slot = heightBuffer.beginWrite(slotIndex);
+    DirtyTiles& destinationDirty = slot ? slotDirty[slotIndex] : stagedDirty;
+    copyHeights(hmap, slot ? slot : heights, destinationDirty);
+    destinationDirty.clear();
+    if (slot)
+        heightBuffer.endWrite();
+    else
+        heightsStaged = true;
 
     generated = true;
     needSendGPU = true;
 }
 
+void HeightMesh::copyHeights(const float* hmap, void* destination, const DirtyTiles& dirty) {
+    auto copyRange = [&](int begin, int end) {
+        if (quantised) {
+            uint16_t* packed = (uint16_t*)destination;
+            for (int i = begin; i < end; i++) {
+                packed[i] = quantiseHeight(hmap[i]);
+            }
+        }
+        else {
+            std::copy(hmap + begin, hmap + end, (float*)destination + begin);
+        }
+    };
+
+    // meshes with a halo are only ever written whole
+    if (halo > 0) {
+        const int rowLength = xWidth + 2 * halo;
+        TaskScheduler::get().parallelFor(0, zWidth + 2 * halo, [&](int z) {
+            copyRange(z * rowLength, (z + 1) * rowLength);
+        }, TaskScheduler::HIGH);
+        return;
+    }
+
+    // copy the row segments of dirty tiles
+    TaskScheduler::get().parallelFor(0, zWidth, [&](int z) {
+        const int tileZ = z / DirtyTiles::TILE_SIZE;
+        for (int tileX = 0; tileX < dirty.tilesX; tileX++) {
+            if (!dirty.tileDirty(tileX, tileZ))
+                continue;
+            const int begin = z * xWidth + tileX * DirtyTiles::TILE_SIZE;
+            const int end = z * xWidth + std::min((tileX + 1) * DirtyTiles::TILE_SIZE, xWidth);
+            copyRange(begin, end);
+        }
+    }, TaskScheduler::HIGH);
+}
+
 void HeightMesh::sendGPU() {
     // send mesh data to GPU
     // generate buffers first time
     if (!createdOnGPU) {
         createdOnGPU = true;
 
-        // generate buffers
+        // no index or vertex buffers, positions come from the vertex and instance ids and normals from the heights buffer
         glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-        
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(xWidth * zWidth * sizeof(float)));
-        glBindVertexArray(0);
-
-        // send indices to GPU
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(uint32_t), indices, GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        heightBuffer.init(heightBytes(), uploadSlots);
     }
 
-    // update heights
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, xWidth * zWidth * 4 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, xWidth * zWidth * sizeof(float), heights);
-    glBufferSubData(GL_ARRAY_BUFFER, xWidth * zWidth * sizeof(float), xWidth * zWidth * 3 * sizeof(float), normals);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // heights generated before the buffer existed, or while every slot was in use, are copied now
+    if (heightsStaged) {
+        slotDirty[heightBuffer.upload(heights)].clear();
+        heightsStaged = false;
+    }
+
+    // rows containing changed tiles, used when slots have to be copied to the GPU
+    std::vector<StreamBuffer::Range> changedRows;
+    if (halo == 0) {
+        const size_t rowBytes = xWidth * elementBytes();
+        for (int tileZ = 0; tileZ < gpuDirty.tilesZ; tileZ++) {
+            if (!gpuDirty.rowDirty(tileZ))
+                continue;
+            const size_t offset = tileZ * DirtyTiles::TILE_SIZE * rowBytes;
+            const size_t bytes = (std::min((tileZ + 1) * DirtyTiles::TILE_SIZE, zWidth) - tileZ * DirtyTiles::TILE_SIZE) * rowBytes;
+            if (!changedRows.empty() && changedRows.back().offset + changedRows.back().bytes == offset)
+                changedRows.back().bytes += bytes;
+            else
+                changedRows.push_back({ offset, bytes });
+        }
+    }
+    if (heightBuffer.swap(halo == 0 ? &changedRows : nullptr))
+        gpuDirty.clear();
 
     needSendGPU = false;
 }
 
 void HeightMesh::render() {
+	heightBuffer.bind(GL_SHADER_STORAGE_BUFFER, HEIGHTS_BINDING);
+	// each instance is one row of quads drawn as a triangle strip
 	glBindVertexArray(VAO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, xWidth * 2, zWidth - 1);
 	glBindVertexArray(0);
 }
 
+void HeightMesh::bindHeights(unsigned int binding) {
+	heightBuffer.bind(GL_SHADER_STORAGE_BUFFER, binding);
+}
+
 void HeightMesh::clean() {
     if (createdOnGPU) {
-        glDeleteBuffers(1, &EBO);
-        glDeleteBuffers(1, &VBO);
         glDeleteVertexArrays(1, &VAO);
+        heightBuffer.clean();
     }
     
     if (generated) {
         delete[] heights;
-        delete[] normals;
-        delete[] indices;
     }
 
     createdOnGPU = false;
     generated = false;
     needSendGPU = false;
-    numIndices = 0;
+    heightsStaged = false;
     VAO = 0;
-    VBO = 0;
-    EBO = 0;
-}
\ No newline at end of file
+}
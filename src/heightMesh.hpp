@@ -2,26 +2,50 @@
 #define HEIGHT_MESH_HPP_INCLUDED
 
 #include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 #include "vec3.hpp"
+#include "streamBuffer.hpp"
+#include "dirtyTiles.hpp"
 
 class HeightMesh {
 protected:
 	unsigned int VAO = 0;
-	unsigned int EBO = 0;
-	unsigned int VBO = 0;
+	StreamBuffer heightBuffer;
+	int uploadSlots = StreamBuffer::MAX_SLOTS;
 
+	// heights are written straight in to a free upload slot, this copy is only used when none is available
+	// holds 16 bit values in place of floats when the mesh is quantised
 	float* heights = nullptr;
-	Vec3* normals = nullptr;
-	unsigned int* indices = nullptr;
+	std::atomic<bool> heightsStaged = false;
+
+	// tiles each copy of the heights is missing since it was last written, slots are only rewritten where they are behind
+	DirtyTiles slotDirty[StreamBuffer::MAX_SLOTS];
+	DirtyTiles stagedDirty;
+	DirtyTiles gpuDirty; // changed since the last swap, for copies when slots are not mapped
 
 	float cellSize = 1.0f;
 	int xWidth = 256;
 	int zWidth = 256;
+	int halo = 0; // rows and columns of neighbouring heights stored around the grid for normals
+
+	// quantised meshes store heights as 16 bit unorm between heightMin and heightMax
+	bool quantised = false;
+	float heightMin = 0.0f;
+	float heightMax = 1.0f;
+
+	inline int heightCount() const { return (xWidth + 2 * halo) * (zWidth + 2 * halo); }
+	inline size_t heightBytes() const { return quantised ? (heightCount() + 1) / 2 * sizeof(uint32_t) : heightCount() * sizeof(float); }
+	inline size_t elementBytes() const { return quantised ? sizeof(uint16_t) : sizeof(float); }
+	void copyHeights(const float*, void*, const DirtyTiles&);
 
 	bool createdOnGPU = false;
 
 public:
-	unsigned int numIndices = 0;
+	// heights are bound as a storage buffer when drawing, normals are derived from them in the vertex shader
+	static constexpr unsigned int HEIGHTS_BINDING = 8;
+
 	std::atomic<bool> generated = false;
 	std::atomic<bool> needSendGPU = false;
 
@@ -29,12 +53,20 @@ public:
 	HeightMesh(float*, float, int, int);
 	~HeightMesh();
 
-	void init(float, int, int);
-	void generate(float*);
+	void init(float, int, int, int halo_ = 0, int uploadSlots_ = StreamBuffer::MAX_SLOTS);
+	void quantise(float, float);
+	void generate(const float*, const DirtyTiles* dirty = nullptr);
 	void sendGPU();
 	void render();
+	void bindHeights(unsigned int binding);
 	void clean();
-	inline Vec3* getNormals() { return normals; }
+
+	inline uint16_t quantiseHeight(float height) const {
+		const float unorm = (height - heightMin) / (heightMax - heightMin);
+		return (uint16_t)std::lround(std::min(std::max(unorm, 0.0f), 1.0f) * 65535.0f);
+	}
+	inline float getHeightMin() const { return heightMin; }
+	inline float getHeightMax() const { return heightMax; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "heightmapGenerator.hpp"
+#include "taskScheduler.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+void WarpField::generate(const HeightmapParams& params, int originX_, int originZ_, int cellsX, int cellsZ,
+    const std::atomic<bool>* cancel) {
+    originX = originX_;
+    originZ = originZ_;
+    resolution = params.domainWarpResolution;
+
+    // one sample of margin before the grid and two after so every cell has a 4x4 bicubic neighbourhood
+    width = (cellsX - 1) / resolution + 4;
+    const int rows = (cellsZ - 1) / resolution + 4;
+    x.resize(width * rows);
+    z.resize(width * rows);
+
+    TaskScheduler::get().parallelFor(0, rows, [&](int j) {
+        if (cancel && *cancel)
+            return;
+        for (int i = 0; i < width; i++) {
+            const float sampleX = (float)(originX + (i - 1) * resolution);
+            const float sampleZ = (float)(originZ + (j - 1) * resolution);
+            x[j * width + i] = params.domainWarpAmplitude * fractalOctave(params.noiseBasis, 6, 0.001f, 0.5f, 2.0f, sampleX - 1.4f, sampleZ - 4.7f);
+            z[j * width + i] = params.domainWarpAmplitude * fractalOctave(params.noiseBasis, 6, 0.001f, 0.5f, 2.0f, sampleX + 5.2f, sampleZ + 1.3f);
+        }
+    }, TaskScheduler::LOW);
+}
+
+HeightmapGenerator::~HeightmapGenerator() {
+    cancel();
+}
+
+float HeightmapGenerator::sampleHeight(const HeightmapParams& params, const WarpField* warpField, int x, int z) {
+    float dx = 0.0f;
+    float dz = 0.0f;
+
+    if (warpField) {
+        warpField->sample(x, z, dx, dz);
+    }
+    else if (params.domainWarpAmplitude > 0.0f) {
+        dx = params.domainWarpAmplitude * fractalOctave(params.noiseBasis, 6, 0.001f, 0.5f, 2.0f, (float)x - 1.4f, (float)z - 4.7f);
+        dz = params.domainWarpAmplitude * fractalOctave(params.noiseBasis, 6, 0.001f, 0.5f, 2.0f, (float)x + 5.2f, (float)z + 1.3f);
+    }
+
+    // get noise values at current x,z coordinate
+    const float seedOffset = (float)params.seed * params.width;
+    const float mountainOffset = ((float)params.seed + 1.0f) * params.width;
+    const float baseNoise = fractalOctave(params.noiseBasis, 4, params.frequency, 0.5f, 2.0f,
+        (x * params.scale) + seedOffset, (z * params.scale) + seedOffset);
+    const float mountainNoise = fractalOctave(params.noiseBasis, params.nOctaves, params.frequency, params.persistence, params.lacunarity,
+        ((x + dx) * params.scale) + mountainOffset, ((z + dz) * params.scale) + mountainOffset);
+
+    // use noise value to get a height
+    return params.minHeight + baseNoise * std::pow(mountainNoise, 2.0f) * params.amplitude;
+}
+
+bool HeightmapGenerator::generate(const HeightmapParams& params, const WarpField* warpField, int stride,
+    HeightmapResult& result, const std::atomic<bool>* cancel) {
+    const int width = params.width;
+    result.width = width;
+    result.stride = stride;
+    resizeGrid(result.heights, width * width, width);
+
+    // sample noise every stride cells, border cells are left at zero
+    const int samplesWidth = (width - 1) / stride + 2;
+    std::vector<float> samples;
+    float* heights = result.heights.data();
+    if (stride > 1) {
+        samples.resize(samplesWidth * samplesWidth);
+        heights = samples.data();
+    }
+    const int sampleBegin = stride > 1 ? 0 : 1;
+    const int sampleEnd = stride > 1 ? samplesWidth : width - 1;
+    const int rowWidth = stride > 1 ? samplesWidth : width;
+
+    // maxima are kept per row and reduced once the loop is done
+    std::vector<float> rowMax(std::max(samplesWidth, width), 0.0f);
+    TaskScheduler::get().parallelFor(sampleBegin, sampleEnd, [&](int j) {
+        // rows cannot be broken out of inside a parallel loop, skip remaining work instead
+        if (cancel && *cancel)
+            return;
+        for (int i = sampleBegin; i < sampleEnd; i++) {
+            const float height = sampleHeight(params, warpField, i * stride, j * stride);
+            heights[j * rowWidth + i] = height;
+            rowMax[j] = std::max(rowMax[j], height);
+        }
+    }, TaskScheduler::LOW);
+    if (cancel && *cancel)
+        return false;
+
+    // bilinearly upsample previews to the full resolution so they use the same mesh
+    if (stride > 1) {
+        std::fill(rowMax.begin(), rowMax.end(), 0.0f);
+        TaskScheduler::get().parallelFor(1, width - 1, [&](int z) {
+            const int j = z / stride;
+            const float tz = (float)(z - j * stride) / stride;
+            for (int x = 1; x < width - 1; x++) {
+                const int i = x / stride;
+                const float tx = (float)(x - i * stride) / stride;
+                const float* row0 = &samples[j * samplesWidth + i];
+                const float* row1 = row0 + samplesWidth;
+                const float height = lerp(tz, lerp(tx, row0[0], row0[1]), lerp(tx, row1[0], row1[1]));
+                result.heights[z * width + x] = height;
+                rowMax[z] = std::max(rowMax[z], height);
+            }
+        }, TaskScheduler::LOW);
+    }
+    result.maxHeight = *std::max_element(rowMax.begin(), rowMax.end());
+    return true;
+}
+
+void HeightmapGenerator::start(const HeightmapParams& params) {
+    // cancel any in-flight generation, its results are no longer wanted
+    cancel();
+    running = true;
+    worker = TaskScheduler::get().submit([this, params] { generateProgressive(params); }, TaskScheduler::LOW);
+}
+
+void HeightmapGenerator::cancel() {
+    cancelled = true;
+    if (worker.valid())
+        worker.wait();
+    cancelled = false;
+    running = false;
+
+    std::lock_guard<std::mutex> lock(resultMutex);
+    hasResult = false;
+}
+
+bool HeightmapGenerator::poll(HeightmapResult& result) {
+    std::lock_guard<std::mutex> lock(resultMutex);
+    if (!hasResult)
+        return false;
+    std::swap(result, published);
+    hasResult = false;
+    return true;
+}
+
+void HeightmapGenerator::publish(HeightmapResult& result) {
+    // replaces any result the render thread has not picked up yet, only the latest is of use
+    std::lock_guard<std::mutex> lock(resultMutex);
+    std::swap(published, result);
+    hasResult = true;
+}
+
+void HeightmapGenerator::generateProgressive(HeightmapParams params) {
+    WarpField warpField;
+    const bool coarseWarp = params.domainWarpAmplitude > 0.0f && params.domainWarpResolution > 1;
+    if (coarseWarp) {
+        // previews sample up to one stride past the last cell
+        const int cells = params.width + PREVIEW_STRIDES[0];
+        warpField.generate(params, 0, 0, cells, cells, &cancelled);
+        if (cancelled)
+            return;
+    }
+
+    HeightmapResult result;
+    for (const int stride : PREVIEW_STRIDES) {
+        if (stride >= params.width / 16)
+            continue; // too few samples to be a useful preview
+        if (!generate(params, coarseWarp ? &warpField : nullptr, stride, result, &cancelled))
+            return;
+        publish(result);
+    }
+
+    if (generate(params, coarseWarp ? &warpField : nullptr, 1, result, &cancelled))
+        publish(result);
+    running = false;
+}
@@ -0,0 +1,98 @@
+#ifndef HEIGHTMAP_GENERATOR_HPP_INCLUDED
+#define HEIGHTMAP_GENERATOR_HPP_INCLUDED
+
+#include "noise.hpp"
+#include "gridMemory.hpp"
+
+#include <vector>
+#include <atomic>
+#include <future>
+#include <mutex>
+
+// snapshot of the terrain parameters a heightmap is generated from
+struct HeightmapParams {
+    int width = 0;
+    float scale = 0.25f;
+    int nOctaves = 12;
+    float frequency = 0.005f;
+    float amplitude = 300.0f;
+    float persistence = 0.5f;
+    float lacunarity = 2.0f;
+    int seed = 0;
+    float domainWarpAmplitude = 400.0f;
+    int domainWarpResolution = 1;
+    float minHeight = 30.0f;
+    NoiseBasis noiseBasis = NoiseBasis::PERLIN;
+};
+
+// domain warp offsets sampled every resolution cells, upsampled bicubically
+struct WarpField {
+    std::vector<float> x;
+    std::vector<float> z;
+    int width = 0;
+    int resolution = 1;
+    int originX = 0;
+    int originZ = 0;
+
+    // rows are skipped once cancel is set, leaving the field incomplete
+    void generate(const HeightmapParams&, int originX_, int originZ_, int cellsX, int cellsZ,
+        const std::atomic<bool>* cancel = nullptr);
+    inline void sample(int, int, float&, float&) const;
+};
+
+struct HeightmapResult {
+    Grid<float> heights;
+    int width = 0;
+    int stride = 1; // cells between noise samples, 1 for the full resolution heightmap
+    float maxHeight = 0.0f;
+};
+
+// generates heightmaps as a background scheduler task, publishing coarse previews before the full resolution result
+class HeightmapGenerator {
+private:
+    static constexpr int PREVIEW_STRIDES[2] = { 8, 4 };
+
+    std::future<void> worker;
+    std::atomic<bool> cancelled = false;
+    std::atomic<bool> running = false;
+
+    std::mutex resultMutex;
+    HeightmapResult published;
+    std::atomic<bool> hasResult = false;
+
+    void generateProgressive(HeightmapParams params);
+    void publish(HeightmapResult& result);
+public:
+    HeightmapGenerator() = default;
+    HeightmapGenerator(const HeightmapGenerator&) = delete;
+    ~HeightmapGenerator();
+
+    void start(const HeightmapParams& params);
+    void cancel();
+    bool poll(HeightmapResult& result);
+    inline bool busy() const { return running || hasResult; }
+
+    static float sampleHeight(const HeightmapParams&, const WarpField*, int, int);
+    static bool generate(const HeightmapParams&, const WarpField*, int, HeightmapResult&, const std::atomic<bool>* cancel = nullptr);
+};
+
+void WarpField::sample(int cellX, int cellZ, float& dx, float& dz) const {
+    // offset by one sample of margin before the grid
+    const float fx = (float)(cellX - originX) / resolution + 1.0f;
+    const float fz = (float)(cellZ - originZ) / resolution + 1.0f;
+    const int ix = (int)fx;
+    const int iz = (int)fz;
+    const float tx = fx - ix;
+    const float tz = fz - iz;
+
+    float rowsX[4], rowsZ[4];
+    for (int i = 0; i < 4; i++) {
+        const int row = (iz - 1 + i) * width + ix;
+        rowsX[i] = cubic(tx, x[row - 1], x[row], x[row + 1], x[row + 2]);
+        rowsZ[i] = cubic(tx, z[row - 1], z[row], z[row + 1], z[row + 2]);
+    }
+    dx = cubic(tz, rowsX[0], rowsX[1], rowsX[2], rowsX[3]);
+    dz = cubic(tz, rowsZ[0], rowsZ[1], rowsZ[2], rowsZ[3]);
+}
+
+#endif
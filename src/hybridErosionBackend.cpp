@@ -0,0 +1,171 @@
+#include "hybridErosionBackend.hpp"
+#include "taskScheduler.hpp"
+
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <cmath>
+
+void HybridErosionBackend::init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_) {
+    ErosionBackend::init(heights_, water_, width_, depth_, dirty_);
+    // the CPU's band is stepped without marking tiles, they are all marked when the state is read back
+    gpu.init(heights, water, width, depth, nullptr);
+    resizeGrid(heightOut, width * depth, width);
+    resizeGrid(waterOut, width * depth, width);
+    resizeGrid(sedimentIn, width * depth, width);
+    resizeGrid(sedimentOut, width * depth, width);
+    resizeGrid(totalDeltaHW, width * depth, width, 0.0f);
+    resizeGrid(totalDeltaH, width * depth, width, 0.0f);
+}
+
+void HybridErosionBackend::seed(const ErosionParams& params) {
+    // the GPU seeds its own water on its first step, from the heights uploaded here
+    gpu.seed(params);
+    seedWaterCPU({ heights, heightOut.data(), water, waterOut.data(),
+        sedimentIn.data(), sedimentOut.data(), width, depth }, params);
+    stepsRun = 0;
+    kE = params.kE;
+
+    // start from an even split, the first blocks move it to where it belongs
+    split = std::max(depth / ROW_GROUP / 2, 1) * ROW_GROUP - HALO_ROWS;
+    balancedRows = split;
+    const int gpuRows = split + HALO_ROWS;
+    pushRows(gpuRows, gpuRows + 1, gpuRows);
+    gpu.setActiveRows(gpuRows);
+}
+
+ErosionGrid HybridErosionBackend::cpuBand() {
+    // starts at the top of the CPU's halo, its first row is held fixed like a border
+    const size_t offset = (size_t)(split - HALO_ROWS) * width;
+    return { heights + offset, heightOut.data() + offset, water + offset, waterOut.data() + offset,
+        sedimentIn.data() + offset, sedimentOut.data() + offset, width, depth - (split - HALO_ROWS) };
+}
+
+void HybridErosionBackend::dryRow(int z) {
+    // fixed rows are kept dry so no water flows in from a row that isn't stepped
+    for (int x = 1; x < width - 1; x++) {
+        const int cellIndex = z * width + x;
+        water[cellIndex] = waterOut[cellIndex] = 0.0f;
+        sedimentIn[cellIndex] = sedimentOut[cellIndex] = 0.0f;
+    }
+}
+
+void HybridErosionBackend::pullRows(int z0, int z1) {
+    if (z1 <= z0)
+        return;
+    const size_t offset = (size_t)z0 * width;
+    gpu.readRows(z0, z1, heightOut.data() + offset, waterOut.data() + offset, sedimentOut.data() + offset);
+
+    // evaporate as the GPU would at the start of its next step, leaving the rows as the CPU's are between steps
+    TaskScheduler::get().parallelFor(std::max(z0, 1), std::min(z1, depth - 1), [&](int z) {
+        for (int x = 1; x < width - 1; x++) {
+            const int cellIndex = z * width + x;
+            waterOut[cellIndex] *= kE;
+            if (waterOut[cellIndex] < 0.000001f) {
+                heightOut[cellIndex] += sedimentOut[cellIndex];
+                sedimentOut[cellIndex] = 0.0f;
+                waterOut[cellIndex] = 0.0f;
+            }
+            heights[cellIndex] = heightOut[cellIndex];
+            water[cellIndex] = waterOut[cellIndex];
+            sedimentIn[cellIndex] = sedimentOut[cellIndex];
+        }
+    });
+}
+
+void HybridErosionBackend::pushRows(int z0, int z1, int fixedRow) {
+    if (z1 <= z0)
+        return;
+    const size_t count = (size_t)(z1 - z0) * width;
+    rowHeights.resize(count);
+    rowWater.resize(count);
+    rowSediment.resize(count);
+
+    // the GPU evaporates again at the start of its next step, so the CPU's evaporation is undone
+    const float unevaporate = kE > 0.0f ? 1.0f / kE : 0.0f;
+    TaskScheduler::get().parallelFor(z0, z1, [&](int z) {
+        const int rowIndex = (z - z0) * width;
+        std::copy(heights + z * width, heights + (z + 1) * width, rowHeights.begin() + rowIndex);
+        std::copy(water + z * width, water + (z + 1) * width, rowWater.begin() + rowIndex);
+        std::copy(sedimentIn.begin() + z * width, sedimentIn.begin() + (z + 1) * width, rowSediment.begin() + rowIndex);
+        if (z == 0 || z == depth - 1)
+            return;
+        for (int x = 1; x < width - 1; x++) {
+            const bool fixed = z == fixedRow;
+            rowWater[rowIndex + x] = fixed ? 0.0f : rowWater[rowIndex + x] * unevaporate;
+            rowSediment[rowIndex + x] = fixed ? 0.0f : rowSediment[rowIndex + x];
+        }
+    });
+    gpu.writeRows(z0, z1, rowHeights.data(), rowWater.data(), rowSediment.data());
+}
+
+int HybridErosionBackend::balancedSplit(double gpuSeconds, double cpuSeconds) {
+    if (gpuSeconds <= 0.0 || cpuSeconds <= 0.0)
+        return split;
+
+    // rows per second each side got through, halos included as they cost as much as any other row
+    const double gpuRate = gpu.getActiveRows() / gpuSeconds;
+    const double cpuRate = (depth - split + HALO_ROWS) / cpuSeconds;
+    // where (split + halo) / gpuRate == (depth - split + halo) / cpuRate
+    const double target = (depth + 2.0 * HALO_ROWS) * gpuRate / (gpuRate + cpuRate) - HALO_ROWS;
+    // smoothed so a block slowed by a frame or other tasks doesn't throw rows back and forth
+    balancedRows += (target - balancedRows) * 0.5;
+
+    // each side keeps at least a workgroup of rows
+    const int groups = std::clamp((int)std::lround((balancedRows + HALO_ROWS) / ROW_GROUP), 1, depth / ROW_GROUP - 1);
+    return groups * ROW_GROUP - HALO_ROWS;
+}
+
+void HybridErosionBackend::exchange(int newSplit) {
+    // the CPU's new halo comes from rows only the GPU has current, the GPU's new halo and fixed row from the CPU's
+    const int gpuRows = newSplit + HALO_ROWS;
+    pullRows(std::max(newSplit - HALO_ROWS, 0), split);
+    pushRows(split, std::min(gpuRows + 1, depth), gpuRows);
+    dryRow(newSplit - HALO_ROWS);
+    split = newSplit;
+    gpu.setActiveRows(gpuRows);
+}
+
+int HybridErosionBackend::runSteps(int n, const ErosionParams& params, const std::atomic<bool>* running) {
+    kE = params.kE;
+    // reading the state back fills the CPU's fixed row from the GPU
+    dryRow(split - HALO_ROWS);
+
+    int done = 0;
+    while (done < n && (!running || *running)) {
+        const int block = std::min(EXCHANGE_STEPS, n - done);
+        const ErosionGrid band = cpuBand();
+        const size_t offset = (size_t)(split - HALO_ROWS) * width;
+        const int firstStep = stepsRun;
+
+        // the CPU's band runs on the scheduler while this thread keeps the GPU busy with its own
+        double cpuSeconds = 0.0;
+        std::future<void> cpuBlock = TaskScheduler::get().submit([&]() {
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < block; i++) {
+                erosionStepGatherCPU(band, params, firstStep + i, totalDeltaHW.data() + offset, totalDeltaH.data() + offset);
+            }
+            cpuSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }, TaskScheduler::NORMAL);
+        const double gpuStart = gpu.getStats().seconds;
+        gpu.step(block, params);
+        const double gpuSeconds = gpu.getStats().seconds - gpuStart;
+        cpuBlock.get();
+
+        stepsRun += block;
+        done += block;
+        exchange(balancedSplit(gpuSeconds, cpuSeconds));
+    }
+    return done;
+}
+
+void HybridErosionBackend::readState() {
+    // the grids are already current until a step has run
+    if (stepsRun == 0)
+        return;
+
+    // the CPU's band is already in the bound grids
+    pullRows(0, split);
+    if (dirty)
+        dirty->markAll();
+}
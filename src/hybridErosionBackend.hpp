@@ -0,0 +1,54 @@
+#ifndef HYBRID_EROSION_BACKEND_HPP_INCLUDED
+#define HYBRID_EROSION_BACKEND_HPP_INCLUDED
+
+#include "erosionBackend.hpp"
+#include "gpuErosionBackend.hpp"
+#include "gridMemory.hpp"
+
+#include <vector>
+
+// splits the grid in to a band of rows at the top eroded on the GPU and the rest eroded on the scheduler at the same time
+// each side also steps a halo of the other's rows, so the bands only need exchanging between blocks of steps
+// the split is moved after every block towards where both sides would take as long, from how long each took
+class HybridErosionBackend : public ErosionBackend {
+private:
+    // a step reads neighbours of neighbours, so changes spread two rows per step and the halo covers a whole block
+    constexpr static int EXCHANGE_STEPS = 4;
+    constexpr static int HALO_ROWS = 2 * EXCHANGE_STEPS + 1;
+    // the GPU's rows including its halo are kept to whole workgroups
+    constexpr static int ROW_GROUP = 32;
+
+    GPUErosionBackend gpu;
+    Grid<float> heightOut;
+    Grid<float> waterOut;
+    Grid<float> sedimentIn;
+    Grid<float> sedimentOut;
+    Grid<float> totalDeltaHW;
+    Grid<float> totalDeltaH;
+    std::vector<float> rowHeights;
+    std::vector<float> rowWater;
+    std::vector<float> rowSediment;
+
+    int split = 0; // first row the CPU's band is current for, rows above it are current on the GPU
+    double balancedRows = 0.0; // smoothed split that would have taken both sides as long
+    float kE = 1.0f; // evaporation of the last run, applied to rows as they are brought back from the GPU
+
+    ErosionGrid cpuBand();
+    void dryRow(int z);
+    int balancedSplit(double gpuSeconds, double cpuSeconds);
+    void pullRows(int z0, int z1);
+    void pushRows(int z0, int z1, int fixedRow);
+    void exchange(int newSplit);
+protected:
+    int runSteps(int n, const ErosionParams&, const std::atomic<bool>* running) override;
+public:
+    void init(float* heights_, float* water_, int width_, int depth_, DirtyTiles* dirty_) override;
+    void seed(const ErosionParams&) override;
+    void readState() override;
+
+    bool needsGL() const override { return true; }
+
+    inline int getSplit() const { return split; }
+};
+
+#endif
@@ -13,9 +13,17 @@
 #include "tree.hpp"
 #include "noise.hpp"
 #include "camera.hpp"
+#include "benchmark.hpp"
+#include "chunkManager.hpp"
+#include "taskScheduler.hpp"
+#include "gridMemory.hpp"
+#include "erosionBackend.hpp"
+#include "erosionTuning.hpp"
 
 #include <iostream>
 #include <vector>
+#include <cstring>
+#include <cstdlib>
 
 // Request high performance GPU
 #ifdef _WIN32
@@ -30,6 +38,7 @@ namespace {
 
     // environment
     Terrain terrainPatch;
+    ChunkManager world;
     Skybox skybox;
 
     // cameras
@@ -40,6 +49,7 @@ namespace {
 
     // shaders
     ShaderProgram* terrainShader;
+    ShaderProgram* terrainLodShader;
     ShaderProgram* waterShader;
     ShaderProgram* cubemapShader;
     ShaderProgram* treeShader;
@@ -72,17 +82,76 @@ namespace {
     bool showTrees = true;
     const char* terrainSizes[5] = { "256", "512", "1024", "2048", "4096" };
     int selectedTerrainSize = 2;
+    const char* noiseBases[2] = { "perlin", "simplex" };
+    int selectedNoiseBasis = 0;
+    const char* warpResolutions[5] = { "full", "1/2", "1/4", "1/8", "1/16" };
+    int selectedWarpResolution = 0;
+    const char* waterResolutions[3] = { "full", "1/2", "1/4" };
+    int selectedWaterResolution = 1;
+    bool liveGenerate = false;
+    bool streamWorld = false;
+    bool lodTerrain = false;
     int cameraTypeToggle = 0;
+    int continueSteps = 500;
 
     void defineUI();
     void handleEvents();
     void loadShaders();
     void loadTextures();
     void renderScene();
+    void recenterCameras();
 };
 
-int main()
+int main(int argc, char** argv)
 {
+    // the erosion configuration autotuned for this machine, if there is one, the command line overrides it
+    ErosionTuning tuning;
+    if (erosionTuning::load(tuning)) {
+        erosionTuning::apply(tuning);
+        if (findErosionBackend(tuning.backend))
+            terrainPatch.erosionManager.backendName = tuning.backend;
+    }
+
+    // worker threads shared by erosion, meshing and generation, one fewer than the cores by default
+    // and placement of the grids they work on, for machines with more than one NUMA node, and the erosion backend
+    GridMemoryOptions gridOptions;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            TaskScheduler::get().setThreadBudget(std::atoi(argv[i + 1]));
+        else if (std::strcmp(argv[i], "--pin-threads") == 0)
+            TaskScheduler::get().setPinning(true);
+        else if (std::strcmp(argv[i], "--numa-interleave") == 0)
+            gridOptions.interleave = true;
+        else if (std::strcmp(argv[i], "--huge-pages") == 0)
+            gridOptions.hugePages = true;
+        else if (std::strcmp(argv[i], "--cooperative") == 0)
+            terrainPatch.erosionManager.cooperative = true;
+        else if (std::strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (!findErosionBackend(argv[i + 1])) {
+                std::cout << "Unknown erosion backend " << argv[i + 1] << ", see --list-backends" << std::endl;
+                return -1;
+            }
+            terrainPatch.erosionManager.backendName = argv[i + 1];
+        }
+    }
+    gridMemory::setOptions(gridOptions);
+
+    // headless benchmark modes
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--bench-noise") == 0)
+            return runNoiseBenchmark();
+        if (std::strcmp(argv[i], "--bench-erosion") == 0)
+            return runErosionBenchmark();
+        if (std::strcmp(argv[i], "--autotune") == 0)
+            return runErosionAutotune(i + 1 < argc && std::atoi(argv[i + 1]) > 0 ? std::atoi(argv[i + 1]) : 512);
+        if (std::strcmp(argv[i], "--list-backends") == 0) {
+            for (const ErosionBackendInfo& info : erosionBackends()) {
+                std::cout << info.name << "\t" << info.description << std::endl;
+            }
+            return 0;
+        }
+    }
+
     window = Window::getInstance();
     
     // create window
@@ -124,10 +193,21 @@ int main()
         fps = 1.0f / deltaTime;
         oTime = time;
 
+        // pick up any heightmap generated in the background, recentering cameras once it is complete
+        if (terrainPatch.updateHeightmap())
+            recenterCameras();
+
+        // step a cooperative erosion run for this frame's share of time, ahead of uploading any mesh it built
+        terrainPatch.erosionManager.update();
+
         // update meshes if needed
         if (terrainPatch.needMeshSentGPU())
             terrainPatch.sendMeshGPU();
 
+        // stream world chunks in and out around the camera
+        if (streamWorld)
+            world.update(camera->position / terrainPatch.scale);
+
         // event handling
         glfwPollEvents();
         handleEvents();
@@ -157,6 +237,7 @@ int main()
 
     // clean resources
     terrainShader->clean();
+    terrainLodShader->clean();
     waterShader->clean();
     cubemapShader->clean();
     treeShader->clean();
@@ -171,6 +252,7 @@ int main()
     mudTextureNormal->clean();
     mudTexture->clean();
 
+    world.clean();
     terrainPatch.clean();
     window->clean();
 
@@ -185,6 +267,9 @@ namespace {
         terrainShader = new ShaderProgram(std::vector<Shader>{
             {"res/shaders/terrain.vert", GL_VERTEX_SHADER},
             {"res/shaders/terrain.frag", GL_FRAGMENT_SHADER}});
+        terrainLodShader = new ShaderProgram(std::vector<Shader>{
+            {"res/shaders/terrainLod.vert", GL_VERTEX_SHADER},
+            {"res/shaders/terrain.frag", GL_FRAGMENT_SHADER}});
         waterShader = new ShaderProgram(std::vector<Shader>{
             {"res/shaders/water.vert", GL_VERTEX_SHADER},
             {"res/shaders/water.frag", GL_FRAGMENT_SHADER}});
@@ -195,16 +280,18 @@ namespace {
             {"res/shaders/billboard.vert", GL_VERTEX_SHADER},
             {"res/shaders/billboard.frag", GL_FRAGMENT_SHADER}});
 
-        // set texture binding points
-        glUseProgram(terrainShader->glID);
-        glUniform1i(9, 0);  
-        glUniform1i(10, 1);
-        glUniform1i(11, 2); 
-        glUniform1i(12, 3);
-        glUniform1i(13, 4);
-        glUniform1i(14, 5);
-        glUniform1i(15, 6); 
-        glUniform1i(16, 7);
+        // set texture binding points, both terrain programs share the fragment shader
+        for (ShaderProgram* shader : { terrainShader, terrainLodShader }) {
+            glUseProgram(shader->glID);
+            glUniform1i(9, 0);
+            glUniform1i(10, 1);
+            glUniform1i(11, 2);
+            glUniform1i(12, 3);
+            glUniform1i(13, 4);
+            glUniform1i(14, 5);
+            glUniform1i(15, 6);
+            glUniform1i(16, 7);
+        }
 
         // bind textures to shaders
         glActiveTexture(GL_TEXTURE0);
@@ -262,28 +349,38 @@ namespace {
 
         // draw window contents
         // draw terrain
-        glUseProgram(terrainShader->glID);
+        const bool drawLod = lodTerrain && !streamWorld;
+        glUseProgram(drawLod ? terrainLodShader->glID : terrainShader->glID);
         glUniformMatrix4fv(0, 1, GL_TRUE, &mvp.m00);
         glUniformMatrix4fv(1, 1, GL_TRUE, &model.m00);
-        glUniform1i(2, terrainPatch.width);
+        glUniform1i(2, streamWorld ? ChunkManager::CHUNK_VERTS : terrainPatch.width);
         glUniform3fv(3, 1, &camera->position.x);
         glUniform3fv(4, 1, &lightDirectionNorm.x);
         glUniform3fv(5, 1, &lightColour.x);
         glUniform2fv(6, 1, &fogDistances.x);
         glUniform3fv(7, 1, &fogColour.x);
         glUniform1i(8, showWater);
-        glUniform1f(17, terrainPatch.maxHeight);
-        terrainPatch.renderTerrain();
+        glUniform1f(17, streamWorld ? world.maxHeight : terrainPatch.maxHeight);
+        if (streamWorld) {
+            world.render();
+        }
+        else if (drawLod) {
+            terrainPatch.renderTerrainLod(mvp, camera->position);
+        }
+        else {
+            glUniform2f(18, 0.0f, 0.0f);
+            glUniform1i(19, 0);
+            terrainPatch.renderTerrain();
+        }
 
-        // render water
-        if (showWater && terrainPatch.erosionManager.hydraulicEnabled) {
+        // render water, streamed chunks are not eroded so have none
+        if (showWater && terrainPatch.erosionManager.hydraulicEnabled && !streamWorld) {
             glEnable(GL_BLEND);
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
             glUseProgram(waterShader->glID);
             glUniformMatrix4fv(0, 1, GL_TRUE, &mvp.m00);
             glUniformMatrix4fv(1, 1, GL_TRUE, &model.m00);
-            glUniform1i(2, terrainPatch.width);
             glUniform3fv(3, 1, &camera->position.x);
             glUniform3fv(4, 1, &lightDirectionNorm.x);
             glUniform3fv(5, 1, &lightColour.x);
@@ -309,7 +406,7 @@ namespace {
         skybox.render();
 
         // render trees
-        if (showTrees) {
+        if (showTrees && !streamWorld) {
             glUseProgram(treeShader->glID);
             glUniformMatrix4fv(0, 1, GL_TRUE, &projection.m00);
             glUniformMatrix4fv(1, 1, GL_TRUE, &cameraViewProjection.m00);
@@ -327,6 +424,15 @@ namespace {
         }
     }
 
+    void recenterCameras() {
+        orbitalCamera.position.x = terrainPatch.width * terrainPatch.scale / 2.0f;
+        orbitalCamera.position.y = terrainPatch.maxHeight / 2.5f;
+        orbitalCamera.position.z = terrainPatch.width * terrainPatch.scale / 2.0f;
+        freeCamera.position.x = orbitalCamera.position.x;
+        freeCamera.position.y = terrainPatch.maxHeight;
+        freeCamera.position.z = orbitalCamera.position.z;
+    }
+
     void handleEvents() {
         // toggle camera mode
         if ((window->keys[GLFW_KEY_ENTER] && !cameraTypeToggle)) {
@@ -363,32 +469,52 @@ namespace {
             if (ImGui::BeginMenu("Terrain")) {
                 // options for generating heightmap
                 ImGui::Text("Heightmap Parameters");
-                ImGui::Combo("size", &selectedTerrainSize, terrainSizes, IM_ARRAYSIZE(terrainSizes));
-                ImGui::SliderInt("octaves", &terrainPatch.nOctaves, 1, 16);
-                ImGui::SliderFloat("frequency", &terrainPatch.frequency, 0.001f, 0.01f);
-                ImGui::SliderFloat("amplitude", &terrainPatch.amplitude, 1.0f, 400.0f);
-                ImGui::SliderFloat("persistence", &terrainPatch.persistence, 0.0f, 0.75f);
-                ImGui::SliderFloat("lacunarity", &terrainPatch.lacunarity, 1.0f, 4.0f);
-                ImGui::SliderFloat("domain warp", &terrainPatch.domainWarpAmplitude, 0.0f, 1000.0f);
-                ImGui::SliderInt("seed", &terrainPatch.seed, 0, 100);
-
-                // if the generate button has been clicked
-                if (ImGui::Button("Generate")) {
-                    // regenerate terrain based on updated values
+                bool paramsChanged = false;
+                paramsChanged |= ImGui::Combo("size", &selectedTerrainSize, terrainSizes, IM_ARRAYSIZE(terrainSizes));
+                if (ImGui::Combo("noise basis", &selectedNoiseBasis, noiseBases, IM_ARRAYSIZE(noiseBases))) {
+                    terrainPatch.noiseBasis = static_cast<NoiseBasis>(selectedNoiseBasis);
+                    paramsChanged = true;
+                }
+                paramsChanged |= ImGui::SliderInt("octaves", &terrainPatch.nOctaves, 1, 16);
+                paramsChanged |= ImGui::SliderFloat("frequency", &terrainPatch.frequency, 0.001f, 0.01f);
+                paramsChanged |= ImGui::SliderFloat("amplitude", &terrainPatch.amplitude, 1.0f, 400.0f);
+                paramsChanged |= ImGui::SliderFloat("persistence", &terrainPatch.persistence, 0.0f, 0.75f);
+                paramsChanged |= ImGui::SliderFloat("lacunarity", &terrainPatch.lacunarity, 1.0f, 4.0f);
+                paramsChanged |= ImGui::SliderFloat("domain warp", &terrainPatch.domainWarpAmplitude, 0.0f, 1000.0f);
+                // lower warp resolutions trade accuracy of the warp field for generation speed
+                if (ImGui::Combo("warp resolution", &selectedWarpResolution, warpResolutions, IM_ARRAYSIZE(warpResolutions))) {
+                    terrainPatch.domainWarpResolution = 1 << selectedWarpResolution;
+                    paramsChanged = true;
+                }
+                paramsChanged |= ImGui::SliderInt("seed", &terrainPatch.seed, 0, 100);
+                ImGui::Checkbox("live generate", &liveGenerate);
+
+                // if the generate button has been clicked, or parameters changed while live generating
+                // regenerate terrain in the background based on updated values
+                if (ImGui::Button("Generate") || (liveGenerate && paramsChanged)) {
                     terrainPatch.erosionManager.stopErosion();
-                    terrainPatch.clean();
-                    terrainPatch.generateHeightmap(atoi(terrainSizes[selectedTerrainSize]));
-                    terrainPatch.generateMesh(false);
-                    terrainPatch.sendMeshGPU();
-
-                    // recenter cameras
-                    orbitalCamera.position.x = terrainPatch.width * terrainPatch.scale / 2.0f;
-                    orbitalCamera.position.y = terrainPatch.maxHeight / 2.5f;
-                    orbitalCamera.position.z = terrainPatch.width * terrainPatch.scale / 2.0f;
-                    freeCamera.position.x = orbitalCamera.position.x;
-                    freeCamera.position.y = terrainPatch.maxHeight;
-                    freeCamera.position.z = orbitalCamera.position.z;
+                    terrainPatch.requestHeightmap(atoi(terrainSizes[selectedTerrainSize]));
+                    if (streamWorld)
+                        world.init(terrainPatch.getHeightmapParams(atoi(terrainSizes[selectedTerrainSize])),
+                            terrainPatch.erosionManager.getParams());
                 }
+                if (terrainPatch.isGenerating())
+                    ImGui::Text("Generating...");
+
+                // streamed world made of chunks generated around the camera instead of a single patch
+                ImGui::Text("Streaming World");
+                if (ImGui::Checkbox("stream world", &streamWorld)) {
+                    if (streamWorld)
+                        world.init(terrainPatch.getHeightmapParams(atoi(terrainSizes[selectedTerrainSize])),
+                            terrainPatch.erosionManager.getParams());
+                    else
+                        world.clean();
+                }
+                ImGui::SliderInt("view distance", &world.viewRadius, 1, 8);
+                ImGui::SliderInt("max resident chunks", &world.maxResidentChunks, 9, 400);
+                ImGui::SliderInt("chunk erosion iterations", &world.erosionSteps, 0, 500);
+                if (streamWorld)
+                    ImGui::Text("Chunks resident: %d pending: %d", world.residentCount(), world.pendingCount());
 
                 ImGui::EndMenu();
             }
@@ -402,12 +528,20 @@ namespace {
                     else
                         glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
                 }
-                if (!terrainPatch.getErosionStatus()) {
+                ImGui::Checkbox("LOD terrain", &lodTerrain);
+                if (lodTerrain && !streamWorld) {
+                    ImGui::SliderFloat("LOD distance", &terrainPatch.getLod().lodDistance, 8.0f, 256.0f);
+                    ImGui::Checkbox("GPU occlusion culling", &terrainPatch.getLod().gpuCulling);
+                    ImGui::Text("LOD patches selected: %d", terrainPatch.getLod().getNodeCount());
+                }
+                if (!terrainPatch.getErosionStatus() && !terrainPatch.isGenerating()) {
                     ImGui::Checkbox("show erosion", &showErosion);
                     if (showErosion)
                         ImGui::Checkbox("show water", &showWater);
                     else
                         showWater = false;
+                    if (showWater && ImGui::Combo("water resolution", &selectedWaterResolution, waterResolutions, 3))
+                        terrainPatch.setWaterResolution(1 << selectedWaterResolution);
                     ImGui::Checkbox("show trees", &showTrees);
 
                     // only update if meshes are not pending a send
@@ -440,19 +574,66 @@ namespace {
                 ImGui::Checkbox("enable hydraulic", &terrainPatch.erosionManager.hydraulicEnabled);
                 ImGui::Checkbox("enable thermal", &terrainPatch.erosionManager.thermalEnabled);
                 ImGui::SliderInt("iterations", &terrainPatch.erosionManager.nSteps, 1, 5000);
+                int threadBudget = TaskScheduler::get().getThreadBudget();
+                if (ImGui::SliderInt("worker threads", &threadBudget, 1, TaskScheduler::get().getMaxThreads()))
+                    TaskScheduler::get().setThreadBudget(threadBudget);
+                bool pinThreads = TaskScheduler::get().getPinning();
+                if (ImGui::Checkbox("pin worker threads", &pinThreads))
+                    TaskScheduler::get().setPinning(pinThreads);
+                ImGui::Text("Backend");
+                if (ImGui::BeginCombo("backend", terrainPatch.erosionManager.backendName.c_str())) {
+                    for (const ErosionBackendInfo& info : erosionBackends()) {
+                        if (ImGui::Selectable(info.name, terrainPatch.erosionManager.backendName == info.name))
+                            terrainPatch.erosionManager.backendName = info.name;
+                        if (ImGui::IsItemHovered())
+                            ImGui::SetTooltip("%s", info.description);
+                    }
+                    ImGui::EndCombo();
+                }
+                ImGui::Checkbox("erode between frames", &terrainPatch.erosionManager.cooperative);
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("runs erosion on the render thread within a time budget each frame");
+                ImGui::SliderFloat("frame budget (ms)", &terrainPatch.erosionManager.frameBudget, 1.0f, 16.0f);
+                ImGui::Text("Tiled Erosion");
+                ImGui::SliderInt("tile size", &terrainPatch.erosionManager.tileSize, 64, 1024);
+                ImGui::SliderInt("tile overlap", &terrainPatch.erosionManager.tileOverlap, 4, 64);
                 
-                if (ImGui::Button("Erode CPU"))
-                    terrainPatch.erosionManager.startErosion(ErosionBackend::CPU);
-                if (ImGui::Button("Erode GPU")) {
-                    terrainPatch.erosionManager.startErosion(ErosionBackend::GPU);
-                    terrainPatch.generateMesh(true);
+                // erosion buffers are only set up once the full resolution heightmap is ready
+                if (terrainPatch.isGenerating()) {
+                    ImGui::Text("Waiting for heightmap generation");
+                }
+                else if (!terrainPatch.getErosionStatus()) {
+                    if (ImGui::Button("Erode"))
+                        terrainPatch.erosionManager.startErosion(terrainPatch.erosionManager.nSteps);
                 }
                 
+                ErosionManager& erosion = terrainPatch.erosionManager;
+                ImGui::SliderInt("more steps", &continueSteps, 1, 5000);
                 if (terrainPatch.getErosionStatus()) {
-                    ImGui::Text("Erosion Step: %d", terrainPatch.erosionManager.step);
+                    if (!erosion.getBackend()->progressive())
+                        ImGui::Text("Eroded: %.0f%%", erosion.getBackend()->getProgress() * 100.0f);
+                    else {
+                        ImGui::Text("Erosion Step: %d / %d", erosion.step.load(), erosion.targetStep.load());
+                        if (erosion.paused) {
+                            if (ImGui::Button("Resume"))
+                                erosion.resumeErosion();
+                        }
+                        else if (ImGui::Button("Pause")) {
+                            erosion.pauseErosion();
+                        }
+                        ImGui::SameLine();
+                        if (ImGui::Button("Stop"))
+                            erosion.stopErosion();
+                        ImGui::SameLine();
+                        if (ImGui::Button("Erode More"))
+                            erosion.continueErosion(continueSteps);
+                    }
                 }
-                else {
+                else if (!terrainPatch.isGenerating()) {
                     ImGui::Text("Not currently eroding");
+                    // carries on from the water and sediment the last run left, without reseeding
+                    if (erosion.resumable && ImGui::Button("Erode More"))
+                        erosion.continueErosion(continueSteps);
                     if (ImGui::Button("Calculate Erosion Score")) {
                         score = terrainPatch.erosionManager.calculateScore();
                     }
@@ -499,6 +680,11 @@ namespace {
             ImGui::Text("HMAP_SIZE: %dx%d", terrainPatch.width, terrainPatch.width);
             ImGui::Text("CELL_SCALE: %f", terrainPatch.scale);
             ImGui::Text("HMAP_MEM: %dMB", hmapMem);
+            ImGui::Text("NUMA_NODES: %d", gridMemory::nodeCount());
+            ImGui::Text("EROSION_IDLE: %.2fs", terrainPatch.erosionManager.erosionIdleTime.load());
+            ImGui::Text("MESHER_IDLE: %.2fs", terrainPatch.erosionManager.mesherIdleTime.load());
+            if (const ErosionBackend* backend = terrainPatch.erosionManager.getBackend())
+                ImGui::Text("EROSION_STEP: %.2fms", backend->msPerStep());
             ImGui::End();
         }
     }
@@ -1,33 +1,64 @@
 #include "noise.hpp"
 #include <cstdio>
 #include <iostream>
+#include <algorithm>
 
-float perlinOctave(unsigned int nOctaves, float frequency, float persistence, float lacunarity, float x, float y){
-    // perlin noise rescaled and added into itself to create fractal noise
-    // persistence defines how much of an impact each successive layer of noise has
-    // lacunarity defines how the rate which frequency changes with each successive layer
-    float noise = 0.0f;
-    float amplitude = 1.0f;
-    float totalAmplitude = 0.0f;
-    for (int i=0; i<nOctaves; i++){
-        noise += perlin(x * frequency, y * frequency) * amplitude;
-        totalAmplitude += amplitude;
-        frequency *= lacunarity;
-        amplitude *= persistence;
+namespace {
+    // rescale factors to maximise noise coverage of the -1 to 1 range once octaves are summed
+    // simplex has a lower variance than perlin so is stretched further to give matching terrain
+    constexpr float PERLIN_OCTAVE_SCALE = 1.5f;
+    constexpr float SIMPLEX_OCTAVE_SCALE = 0.68f;
+
+    // skewing factors for 2D simplex noise, (sqrt(3) - 1) / 2 and (3 - sqrt(3)) / 6
+    constexpr float SIMPLEX_F2 = 0.36602540378f;
+    constexpr float SIMPLEX_G2 = 0.21132486540f;
+
+    template <float (*basis)(float, float)>
+    inline float octaveNoise(unsigned int nOctaves, float frequency, float persistence,
+        float lacunarity, float x, float y, float octaveScale) {
+        // basis noise rescaled and added into itself to create fractal noise
+        // persistence defines how much of an impact each successive layer of noise has
+        // lacunarity defines how the rate which frequency changes with each successive layer
+        float noise = 0.0f;
+        float amplitude = 1.0f;
+        float totalAmplitude = 0.0f;
+        for (unsigned int i = 0; i < nOctaves; i++) {
+            noise += basis(x * frequency, y * frequency) * amplitude;
+            totalAmplitude += amplitude;
+            frequency *= lacunarity;
+            amplitude *= persistence;
+        }
+        // divide by total amplitude to normalise
+        return ((noise / totalAmplitude) * octaveScale + 1.0f) * 0.5f; // rescale noise to 0-1 range
     }
-    // divide by total amplitude to normalise
-    // multiply by 1.5 to maximise noise coverage of the -1 to 1 range
-    return ((noise / totalAmplitude) * 1.5f + 1.0f) * 0.5f; // rescale noise to 0-1 range
+}
+
+float fractalOctave(NoiseBasis basis, unsigned int nOctaves, float frequency, float persistence,
+    float lacunarity, float x, float y) {
+    // select basis outside of the octave loop so it is not branched on per octave
+    if (basis == NoiseBasis::SIMPLEX)
+        return simplexOctave(nOctaves, frequency, persistence, lacunarity, x, y);
+    return perlinOctave(nOctaves, frequency, persistence, lacunarity, x, y);
+}
+
+float perlinOctave(unsigned int nOctaves, float frequency, float persistence, float lacunarity, float x, float y){
+    return octaveNoise<perlin>(nOctaves, frequency, persistence, lacunarity, x, y, PERLIN_OCTAVE_SCALE);
+}
+
+float simplexOctave(unsigned int nOctaves, float frequency, float persistence, float lacunarity, float x, float y) {
+    return octaveNoise<simplex>(nOctaves, frequency, persistence, lacunarity, x, y, SIMPLEX_OCTAVE_SCALE);
 }
 
 float perlin(float x, float y) {
-    // find unit square that contains point
-    const int X = (int)x & 255;
-    const int Y = (int)y & 255;
+    // find unit square that contains point, floored so negative world coordinates are continuous
+    const int floorX = fastFloor(x);
+    const int floorY = fastFloor(y);
+    const int X = floorX & 255;
+    const int Y = floorY & 255;
 
     // find relative x,y coord in unit square
-    x -= (int)x;
-    y -= (int)y;
+    x -= floorX;
+    y -= floorY;
 
     // compute fade curve for x and y
     const float u = fade(x);
@@ -43,4 +74,44 @@ float perlin(float x, float y) {
     const float interp0 = lerp(u, grad(permutation[AA], x, y), grad(permutation[BA], x - 1, y));
     const float interp1 = lerp(u, grad(permutation[AB], x, y - 1), grad(permutation[BB], x - 1, y - 1));
     return lerp(v, interp0, interp1); // noise outputs in range -1 to 1
-}
\ No newline at end of file
+}
+
+float simplex(float x, float y) {
+    // skew input space to find which simplex cell (pair of triangles) contains the point
+    const float s = (x + y) * SIMPLEX_F2;
+    const int i = fastFloor(x + s);
+    const int j = fastFloor(y + s);
+
+    // unskew cell origin back to x,y space and find distance from it
+    const float t = (i + j) * SIMPLEX_G2;
+    const float x0 = x - (i - t);
+    const float y0 = y - (j - t);
+
+    // determine which of the two triangles we are in, lower (1,0) or upper (0,1)
+    const int i1 = x0 > y0 ? 1 : 0;
+    const int j1 = 1 - i1;
+
+    // offsets of the middle and last corners in x,y space
+    const float x1 = x0 - i1 + SIMPLEX_G2;
+    const float y1 = y0 - j1 + SIMPLEX_G2;
+    const float x2 = x0 - 1.0f + 2.0f * SIMPLEX_G2;
+    const float y2 = y0 - 1.0f + 2.0f * SIMPLEX_G2;
+
+    // calculate a hash for each of the 3 corners
+    const int ii = i & 255;
+    const int jj = j & 255;
+
+    // sum radially attenuated contributions from each corner, no fade curve or interpolation needed
+    // attenuation is clamped rather than branched on as which corners contribute is unpredictable
+    float t0 = std::max(0.5f - x0 * x0 - y0 * y0, 0.0f);
+    float t1 = std::max(0.5f - x1 * x1 - y1 * y1, 0.0f);
+    float t2 = std::max(0.5f - x2 * x2 - y2 * y2, 0.0f);
+    t0 *= t0;
+    t1 *= t1;
+    t2 *= t2;
+    const float noise =
+        t0 * t0 * simplexGrad(permutation[ii + permutation[jj]], x0, y0) +
+        t1 * t1 * simplexGrad(permutation[ii + i1 + permutation[jj + j1]], x1, y1) +
+        t2 * t2 * simplexGrad(permutation[ii + 1 + permutation[jj + 1]], x2, y2);
+    return noise * 70.0f; // scale to range -1 to 1
+}
@@ -32,8 +32,22 @@ constexpr int permutation[512] = {151,160,137,91,90,15,
     138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180
 };
 
+// basis functions available for fractal noise
+enum class NoiseBasis {
+    PERLIN, SIMPLEX
+};
+
+float fractalOctave(NoiseBasis, unsigned int, float, float, float, float, float);
 float perlinOctave(unsigned int, float, float, float, float, float);
+float simplexOctave(unsigned int, float, float, float, float, float);
 float perlin(float, float);
+float simplex(float, float);
+
+inline int fastFloor(float t) {
+    // floor without the overhead of std::floor, correct for negative values
+    const int i = (int)t;
+    return t < i ? i - 1 : i;
+}
 
 inline float fade(float t) {
     // fade/ease function defined by Ken Perlin
@@ -45,6 +59,11 @@ inline float lerp(float t, float a, float b) {
     return a + t * (b - a);
 };
 
+inline float cubic(float t, float a, float b, float c, float d) {
+    // catmull-rom interpolate between b and c, a and d are the outer neighbours
+    return b + 0.5f * t * (c - a + t * (2.0f * a - 5.0f * b + 4.0f * c - d + t * (3.0f * (b - c) + d - a)));
+}
+
 inline float hermite(float t, float a, float b) {
     // hermite interpolate
     t = (t - a) / (b - a);
@@ -64,4 +83,13 @@ inline float grad(int hash, float x, float y) {
     }
 };
 
+// gradients for simplex noise, it needs the diagonals as well as 4 axis gradients alone show visible artefacts
+// looked up from a table rather than switched on so the corner evaluation is branch free
+constexpr float simplexGradX[8] = { 1.0f, -1.0f,  1.0f, -1.0f, 1.0f, -1.0f, 0.0f,  0.0f };
+constexpr float simplexGradY[8] = { 1.0f,  1.0f, -1.0f, -1.0f, 0.0f,  0.0f, 1.0f, -1.0f };
+
+inline float simplexGrad(int hash, float x, float y) {
+    return simplexGradX[hash & 0x7] * x + simplexGradY[hash & 0x7] * y;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef SIGNAL_HPP_INCLUDED
+#define SIGNAL_HPP_INCLUDED
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// wakes threads blocked until a condition on shared atomics holds
+// the condition must be changed before notify, which takes the lock so a waiter cannot miss it
+class Signal {
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+public:
+    // returns the seconds spent blocked
+    template <class Predicate>
+    double wait(Predicate ready) {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, ready);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void notify() {
+        { std::lock_guard<std::mutex> lock(mutex); }
+        condition.notify_all();
+    }
+};
+
+#endif
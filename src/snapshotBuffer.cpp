@@ -0,0 +1,65 @@
+#include "snapshotBuffer.hpp"
+#include "taskScheduler.hpp"
+
+#include <algorithm>
+
+void SnapshotBuffer::resize(int width_, int depth_) {
+    width = width_;
+    depth = depth_;
+    for (int i = 0; i < SLOTS; i++) {
+        resizeGrid(slots[i].heights, width * depth, width);
+        resizeGrid(slots[i].water, width * depth, width);
+        slots[i].dirty.resize(width, depth);
+        behind[i].resize(width, depth);
+        behind[i].markAll();
+    }
+    accumulated.resize(width, depth);
+    lastPublished.resize(width, depth);
+    back = 0;
+    middle = 1;
+    front = 2;
+}
+
+void SnapshotBuffer::markDirty(const DirtyTiles& dirty) {
+    accumulated.merge(dirty);
+    for (DirtyTiles& slotBehind : behind) {
+        slotBehind.merge(dirty);
+    }
+}
+
+void SnapshotBuffer::copyTiles(const float* source, float* destination, const DirtyTiles& tiles) const {
+    TaskScheduler::get().parallelFor(0, depth, [&](int z) {
+        const int tileZ = z / DirtyTiles::TILE_SIZE;
+        for (int tileX = 0; tileX < tiles.tilesX; tileX++) {
+            if (!tiles.tileDirty(tileX, tileZ))
+                continue;
+            const int begin = z * width + tileX * DirtyTiles::TILE_SIZE;
+            const int end = z * width + std::min((tileX + 1) * DirtyTiles::TILE_SIZE, width);
+            std::copy(source + begin, source + end, destination + begin);
+        }
+    });
+}
+
+void SnapshotBuffer::publish(const float* heights, const float* water) {
+    Snapshot& snapshot = slots[back];
+    copyTiles(heights, snapshot.heights.data(), behind[back]);
+    copyTiles(water, snapshot.water.data(), behind[back]);
+    behind[back].clear();
+
+    // if the last snapshot has not been taken it is replaced, so its changes are carried in to this one
+    // it may be taken in the meantime, which only means rebuilding a few tiles more than needed
+    snapshot.dirty = accumulated;
+    if (!canPublish())
+        snapshot.dirty.merge(lastPublished);
+    lastPublished = snapshot.dirty;
+    accumulated.clear();
+
+    back = middle.exchange(back | FRESH_BIT) & ~FRESH_BIT;
+}
+
+const SnapshotBuffer::Snapshot* SnapshotBuffer::take() {
+    if (!hasSnapshot())
+        return nullptr;
+    front = middle.exchange(front) & ~FRESH_BIT;
+    return &slots[front];
+}
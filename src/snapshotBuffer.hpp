@@ -0,0 +1,53 @@
+#ifndef SNAPSHOT_BUFFER_HPP_INCLUDED
+#define SNAPSHOT_BUFFER_HPP_INCLUDED
+
+#include "dirtyTiles.hpp"
+#include "gridMemory.hpp"
+
+#include <atomic>
+#include <vector>
+
+// triple buffered copies of the erosion state, published by the simulation and taken by the mesher
+// neither side waits on the other, the producer only publishes once the last snapshot has been taken
+// each slot is only copied where it has fallen behind the state, tracked per tile
+class SnapshotBuffer {
+public:
+    struct Snapshot {
+        Grid<float> heights;
+        Grid<float> water;
+        DirtyTiles dirty; // changed since the previous snapshot taken
+    };
+private:
+    static constexpr int SLOTS = 3;
+    static constexpr int FRESH_BIT = 4; // set on the shared index until it is taken
+
+    Snapshot slots[SLOTS];
+    int width = 0;
+    int depth = 0;
+
+    // producer only
+    int back = 0;
+    DirtyTiles behind[SLOTS]; // tiles each slot is missing
+    DirtyTiles accumulated; // changed since the last publish
+    DirtyTiles lastPublished;
+
+    std::atomic<int> middle = 1;
+
+    // consumer only
+    int front = 2;
+
+    void copyTiles(const float*, float*, const DirtyTiles&) const;
+public:
+    void resize(int width_, int depth_);
+
+    // producer
+    void markDirty(const DirtyTiles&);
+    inline bool canPublish() const { return (middle.load() & FRESH_BIT) == 0; }
+    void publish(const float* heights, const float* water);
+
+    // consumer, nullptr when nothing new has been published
+    inline bool hasSnapshot() const { return (middle.load() & FRESH_BIT) != 0; }
+    const Snapshot* take();
+};
+
+#endif
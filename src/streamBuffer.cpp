@@ -0,0 +1,198 @@
+#include "streamBuffer.hpp"
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstring>
+#include <thread>
+
+// buffer storage is core in 4.4, the context is 4.3 so it is loaded as an extension
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+namespace {
+    PFNGLBUFFERSTORAGEPROC loadBufferStorage() {
+        static PFNGLBUFFERSTORAGEPROC bufferStorage = glfwExtensionSupported("GL_ARB_buffer_storage") ?
+            (PFNGLBUFFERSTORAGEPROC)glfwGetProcAddress("glBufferStorage") : nullptr;
+        return bufferStorage;
+    }
+}
+
+StreamBuffer::StreamBuffer() {
+    for (std::atomic<int>& state : states) {
+        state = FREE;
+    }
+}
+
+StreamBuffer::~StreamBuffer() {
+    clean();
+}
+
+void StreamBuffer::init(size_t bytes, int slots) {
+    clean();
+    slotBytes = bytes;
+    nSlots = slots;
+
+    // slots are bound as ranges of one buffer, so offsets must respect the binding alignment
+    GLint alignment = 1;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    slotStride = (slotBytes + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    PFNGLBUFFERSTORAGEPROC bufferStorage = loadBufferStorage();
+    if (bufferStorage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(GL_COPY_WRITE_BUFFER, slotStride * nSlots, nullptr, flags);
+        mapped = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, slotStride * nSlots, flags);
+        persistent = mapped != nullptr;
+    }
+    if (!persistent) {
+        // a single GPU copy, slots only exist in CPU memory
+        glBufferData(GL_COPY_WRITE_BUFFER, slotBytes, nullptr, GL_DYNAMIC_DRAW);
+        staging.resize(slotStride * nSlots);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void StreamBuffer::clean() {
+    if (!buffer)
+        return;
+
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        if (fences[i])
+            glDeleteSync((GLsync)fences[i]);
+        fences[i] = nullptr;
+        states[i] = FREE;
+    }
+    if (mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &buffer);
+
+    buffer = 0;
+    mapped = nullptr;
+    persistent = false;
+    staging.clear();
+    staging.shrink_to_fit();
+    writeSlot = -1;
+    drawSlot = -1;
+}
+
+char* StreamBuffer::slotData(int slot) {
+    return (persistent ? mapped : staging.data()) + slot * slotStride;
+}
+
+void StreamBuffer::retireCompleted(bool wait) {
+    // free slots the GPU has finished reading, optionally blocking on the first outstanding one
+    for (int i = 0; i < nSlots; i++) {
+        if (states[i] != RETIRED)
+            continue;
+        const GLenum status = glClientWaitSync((GLsync)fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            glDeleteSync((GLsync)fences[i]);
+            fences[i] = nullptr;
+            states[i] = FREE;
+            wait = false;
+        }
+    }
+}
+
+int StreamBuffer::acquire() {
+    if (!buffer)
+        return -1;
+    for (int i = 0; i < nSlots; i++) {
+        int expected = FREE;
+        if (states[i].compare_exchange_strong(expected, WRITING))
+            return i;
+    }
+    return -1;
+}
+
+void StreamBuffer::publish(int slot) {
+    // an older slot that has not been drawn yet is superseded, only the latest data is of use
+    for (int i = 0; i < nSlots; i++) {
+        int expected = READY;
+        states[i].compare_exchange_strong(expected, FREE);
+    }
+    states[slot] = READY;
+}
+
+void* StreamBuffer::beginWrite(int& slot) {
+    writeSlot = acquire();
+    slot = writeSlot;
+    return writeSlot == -1 ? nullptr : slotData(writeSlot);
+}
+
+void StreamBuffer::endWrite() {
+    publish(writeSlot);
+    writeSlot = -1;
+}
+
+int StreamBuffer::upload(const void* data) {
+    // render thread path for data that was not written straight in to a slot
+    int slot = acquire();
+    while (slot == -1) {
+        retireCompleted(true);
+        slot = acquire();
+        if (slot == -1)
+            std::this_thread::yield(); // a producer holds the only free slot
+    }
+    std::memcpy(slotData(slot), data, slotBytes);
+    publish(slot);
+    return slot;
+}
+
+bool StreamBuffer::swap(const std::vector<Range>* changed) {
+    retireCompleted(false);
+
+    int ready = -1;
+    for (int i = 0; i < nSlots; i++) {
+        int expected = READY;
+        if (states[i].compare_exchange_strong(expected, DRAWING)) {
+            ready = i;
+            break;
+        }
+    }
+    if (ready == -1)
+        return false;
+
+    if (persistent) {
+        // draws already issued may still read the previous slot
+        if (drawSlot != -1) {
+            fences[drawSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            states[drawSlot] = RETIRED;
+        }
+        drawSlot = ready;
+    }
+    else {
+        // the copy is made now, so the slot can be written again straight away
+        // only ranges changed since the last swap need copying, the first swap copies everything
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (changed && drawSlot != -1) {
+            for (const Range& range : *changed) {
+                glBufferSubData(GL_COPY_WRITE_BUFFER, range.offset, range.bytes, slotData(ready) + range.offset);
+            }
+        }
+        else {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, slotBytes, slotData(ready));
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        states[ready] = FREE;
+        drawSlot = 0;
+    }
+    return true;
+}
+
+void StreamBuffer::bind(unsigned int target, unsigned int binding) {
+    if (drawSlot == -1)
+        return;
+    const size_t offset = persistent ? drawSlot * slotStride : 0;
+    glBindBufferRange(target, binding, buffer, offset, slotBytes);
+}
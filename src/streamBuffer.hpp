@@ -0,0 +1,63 @@
+#ifndef STREAM_BUFFER_HPP_INCLUDED
+#define STREAM_BUFFER_HPP_INCLUDED
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// ring of buffer slots that a producer thread writes in to while the GPU reads another
+// slots are persistently mapped when glBufferStorage is available, so publishing new data is only an offset swap
+// otherwise slots are staged in CPU memory and copied with glBufferSubData on swap
+class StreamBuffer {
+public:
+    static constexpr int MAX_SLOTS = 3;
+
+    struct Range {
+        size_t offset;
+        size_t bytes;
+    };
+private:
+    enum SlotState : int {
+        FREE, // can be written
+        WRITING, // being written by the producer
+        READY, // written, waiting to be drawn
+        DRAWING, // current slot bound for drawing
+        RETIRED // replaced, waiting for the GPU to finish with it
+    };
+
+    unsigned int buffer = 0;
+    size_t slotBytes = 0;
+    size_t slotStride = 0; // slotBytes padded to the storage buffer offset alignment
+    int nSlots = 0;
+    bool persistent = false;
+    char* mapped = nullptr;
+    std::vector<char> staging;
+
+    std::atomic<int> states[MAX_SLOTS];
+    void* fences[MAX_SLOTS] = {}; // GLsync
+    int writeSlot = -1; // slot held by the producer between beginWrite and endWrite
+    int drawSlot = -1;
+
+    char* slotData(int slot);
+    int acquire();
+    void publish(int slot);
+    void retireCompleted(bool wait);
+public:
+    StreamBuffer();
+    StreamBuffer(const StreamBuffer&) = delete;
+    ~StreamBuffer();
+
+    // render thread only
+    void init(size_t bytes, int slots = MAX_SLOTS);
+    void clean();
+    bool swap(const std::vector<Range>* changed = nullptr);
+    void bind(unsigned int target, unsigned int binding);
+    int upload(const void* data);
+    inline bool created() const { return buffer != 0; }
+
+    // producer, returns nullptr if not created or every slot is in use
+    void* beginWrite(int& slot);
+    void endWrite();
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "taskScheduler.hpp"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+    thread_local int workerIndex = -1; // -1 on threads outside the pool
+    thread_local int loopDepth = 0; // parallel loop bodies running on this thread
+}
+
+TaskScheduler& TaskScheduler::get() {
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+TaskScheduler::TaskScheduler() {
+    const int nThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    // leave a core free for the render thread
+    budget = std::max(1, nThreads - 1);
+    for (int i = 0; i < nThreads; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back(&TaskScheduler::workerLoop, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    sleepCondition.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void TaskScheduler::setThreadBudget(int threads_) {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        budget = std::clamp(threads_, 1, (int)workers.size());
+    }
+    // parked workers with queued tasks are stolen from, so nothing is stranded when the budget shrinks
+    sleepCondition.notify_all();
+}
+
+void TaskScheduler::setChunksPerThread(int chunks) {
+    // only loops started afterwards are affected
+    chunksPerThread = std::max(1, chunks);
+}
+
+void TaskScheduler::setPinning(bool pinned_) {
+    pinned = pinned_;
+    const int nCores = (int)threads.size();
+    for (int i = 0; i < nCores; i++) {
+#if defined(_WIN32)
+        const DWORD_PTR allCores = ~(DWORD_PTR)0 >> (sizeof(DWORD_PTR) * 8 - std::min(nCores, (int)sizeof(DWORD_PTR) * 8));
+        SetThreadAffinityMask((HANDLE)threads[i].native_handle(), pinned ? (DWORD_PTR)1 << (i % (sizeof(DWORD_PTR) * 8)) : allCores);
+#elif defined(__linux__)
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        for (int core = 0; core < nCores; core++) {
+            if (!pinned || core == i)
+                CPU_SET(core, &cores);
+        }
+        pthread_setaffinity_np(threads[i].native_handle(), sizeof(cores), &cores);
+#endif
+    }
+}
+
+void TaskScheduler::push(Task task, Priority priority) {
+    // workers push on to their own deque, other threads spread tasks over the active workers
+    int target = workerIndex;
+    if (target == -1 || target >= budget)
+        target = nextWorker++ % budget;
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->queues[priority].push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued++;
+    }
+    // a parked worker woken alone would go straight back to sleep and swallow the notification
+    if (budget < (int)workers.size())
+        sleepCondition.notify_all();
+    else
+        sleepCondition.notify_one();
+}
+
+bool TaskScheduler::pop(int self, Task& task) {
+    const int nWorkers = (int)workers.size();
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++) {
+        // newest task from our own deque while it is still cache warm
+        {
+            Worker& worker = *workers[self];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            std::deque<Task>& queue = worker.queues[priority];
+            if (!queue.empty()) {
+                task = std::move(queue.back());
+                queue.pop_back();
+                return true;
+            }
+        }
+        // otherwise steal the oldest from another worker, including parked ones
+        for (int i = 1; i < nWorkers; i++) {
+            Worker& victim = *workers[(self + i) % nWorkers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            std::deque<Task>& queue = victim.queues[priority];
+            if (!queue.empty()) {
+                task = std::move(queue.front());
+                queue.pop_front();
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::workerLoop(int index) {
+    workerIndex = index;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCondition.wait(lock, [this, index] { return stopping || (index < budget && queued > 0); });
+            if (stopping)
+                return;
+        }
+
+        Task task;
+        if (!pop(index, task))
+            continue; // another worker took it first
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queued--;
+        }
+        task();
+    }
+}
+
+std::future<void> TaskScheduler::submit(std::function<void()> task, Priority priority) {
+    auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+    std::future<void> future = packaged->get_future();
+    push([packaged] { (*packaged)(); }, priority);
+    return future;
+}
+
+TaskScheduler::SerialScope::SerialScope() {
+    loopDepth++;
+}
+
+TaskScheduler::SerialScope::~SerialScope() {
+    loopDepth--;
+}
+
+void TaskScheduler::runLoop(const std::shared_ptr<Loop>& loop) {
+    // claim chunks until none are left, helpers that start late find nothing to do
+    loopDepth++;
+    const int chunkSize = (loop->end - loop->begin + loop->nChunks - 1) / loop->nChunks;
+    for (int chunk = loop->nextChunk++; chunk < loop->nChunks; chunk = loop->nextChunk++) {
+        const int chunkBegin = loop->begin + chunk * chunkSize;
+        loop->body(chunkBegin, std::min(chunkBegin + chunkSize, loop->end));
+        if (++loop->chunksDone == loop->nChunks) {
+            std::lock_guard<std::mutex> lock(loop->mutex);
+            loop->done.notify_all();
+        }
+    }
+    loopDepth--;
+}
+
+void TaskScheduler::parallelChunks(int begin, int end, int grain, Priority priority, std::function<void(int, int)> body) {
+    if (end <= begin)
+        return;
+
+    const int count = end - begin;
+    const int nThreads = budget + 1;
+    const int nChunks = std::min((count + grain - 1) / grain, nThreads * chunksPerThread);
+    if (loopDepth > 0 || nChunks <= 1) {
+        body(begin, end);
+        return;
+    }
+
+    std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+    loop->body = std::move(body);
+    loop->begin = begin;
+    loop->end = end;
+    loop->nChunks = nChunks;
+
+    // the caller takes a share too, so the loop finishes even if every worker is busy
+    const int nHelpers = std::min(nChunks - 1, (int)budget);
+    for (int i = 0; i < nHelpers; i++) {
+        push([loop] { TaskScheduler::get().runLoop(loop); }, priority);
+    }
+    runLoop(loop);
+
+    // wait for chunks other threads are still running
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->done.wait(lock, [&loop] { return loop->chunksDone == loop->nChunks; });
+}
@@ -0,0 +1,108 @@
+#ifndef TASK_SCHEDULER_HPP_INCLUDED
+#define TASK_SCHEDULER_HPP_INCLUDED
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+// one pool of work stealing workers shared by simulation, meshing, generation and streaming
+// each worker has a deque per priority, owners pop their newest task and idle workers steal the oldest from others
+// higher priority tasks are always taken first, so interactive work is picked up between erosion rows
+class TaskScheduler {
+public:
+    enum Priority : int {
+        HIGH, // meshing and uploads the render loop is waiting on
+        NORMAL, // simulation
+        LOW, // heightmap generation and chunk streaming
+        PRIORITY_COUNT
+    };
+private:
+    using Task = std::function<void()>;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queues[PRIORITY_COUNT];
+    };
+
+    // shared between a parallel loop's caller and the helper tasks it submits, which may run after it returns
+    struct Loop {
+        std::function<void(int, int)> body;
+        int begin = 0;
+        int end = 0;
+        int nChunks = 0;
+        std::atomic<int> nextChunk = 0;
+        std::atomic<int> chunksDone = 0;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    // workers are created for every hardware thread, those past the budget are parked
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<int> budget = 1;
+    std::atomic<int> chunksPerThread = 4; // spare chunks so threads finishing early can take more
+    std::atomic<unsigned int> nextWorker = 0;
+    bool pinned = false;
+
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    int queued = 0; // tasks not yet taken, guarded by sleepMutex
+    bool stopping = false;
+
+    TaskScheduler();
+    ~TaskScheduler();
+
+    void push(Task task, Priority priority);
+    bool pop(int self, Task& task);
+    void workerLoop(int index);
+    void runLoop(const std::shared_ptr<Loop>& loop);
+    void parallelChunks(int begin, int end, int grain, Priority priority, std::function<void(int, int)> body);
+public:
+    TaskScheduler(const TaskScheduler&) = delete;
+
+    static TaskScheduler& get();
+
+    // worker threads, the thread calling parallelFor also runs part of the loop
+    void setThreadBudget(int threads_);
+    inline int getThreadBudget() const { return budget; }
+    inline int getMaxThreads() const { return (int)workers.size(); }
+
+    // chunks each thread's share of a parallel loop is cut in to, 1 splits loops evenly up front like a static schedule
+    // and more balance uneven rows at the cost of more handoffs, like a dynamic one
+    void setChunksPerThread(int chunks);
+    inline int getChunksPerThread() const { return chunksPerThread; }
+
+    // pins worker i to logical core i, so pages a worker first touched stay local to it
+    void setPinning(bool pinned_);
+    inline bool getPinning() const { return pinned; }
+
+    // long running tasks hold a worker until they return, their parallel loops are spread over the rest
+    std::future<void> submit(std::function<void()> task, Priority priority);
+
+    // runs body(i) for i in [begin, end), returning once every index is done
+    // loops started from inside another parallel loop run on the calling thread, like nested omp regions
+    template <class Body>
+    void parallelFor(int begin, int end, Body&& body, Priority priority = NORMAL, int grain = 1) {
+        parallelChunks(begin, end, grain, priority, [&body](int chunkBegin, int chunkEnd) {
+            for (int i = chunkBegin; i < chunkEnd; i++) {
+                body(i);
+            }
+        });
+    }
+
+    // parallel loops started on this thread while a scope is alive run serially on it, as if nested
+    class SerialScope {
+    public:
+        SerialScope();
+        ~SerialScope();
+        SerialScope(const SerialScope&) = delete;
+    };
+};
+
+#endif
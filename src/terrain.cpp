@@ -2,61 +2,128 @@
 #include "vec3.hpp"
 #include "noise.hpp"
 #include "window.hpp"
+#include "taskScheduler.hpp"
 
 #include <cstdlib>
 #include <iostream>
 #include <algorithm>
 #include <chrono>
-#include <omp.h>
 
 Terrain::Terrain(unsigned int aHeightmapSize, float aScale) {
-    width = aHeightmapSize;
-    size = width * width;
     scale = aScale;
     generateHeightmap(aHeightmapSize);
     generateMesh(false);
 }
 
+HeightmapParams Terrain::getHeightmapParams(int width_) const {
+    HeightmapParams params;
+    params.width = width_;
+    params.scale = scale;
+    params.nOctaves = nOctaves;
+    params.frequency = frequency;
+    params.amplitude = amplitude;
+    params.persistence = persistence;
+    params.lacunarity = lacunarity;
+    params.seed = seed;
+    params.domainWarpAmplitude = domainWarpAmplitude;
+    params.domainWarpResolution = domainWarpResolution;
+    params.minHeight = minHeight;
+    params.noiseBasis = noiseBasis;
+    return params;
+}
+
 void Terrain::generateHeightmap(int width_) {
-    width = width_;
-    size = width * width;
+    // synchronous generation, straight to full resolution
+    generator.cancel();
+    if (preparing.valid())
+        preparing.get();
+    const HeightmapParams params = getHeightmapParams(width_);
 
-    std::atomic<float> heightMaxAtomic = 0.0f;
-    heightmap = std::vector<float>(size);
-    water = std::vector<float>(size);
-    altitude = std::vector<float>(size);
+    WarpField warpField;
+    const bool coarseWarp = domainWarpAmplitude > 0.0f && domainWarpResolution > 1;
+    if (coarseWarp) {
+        warpField.generate(params, 0, 0, width_, width_);
+    }
 
-    #pragma omp parallel for
-    for (int z = 1; z < width - 1; z++){
-        for (int x = 1; x < width - 1; x++){
-            float dx = 0.0f; 
-            float dz = 0.0f;
+    HeightmapResult result;
+    HeightmapGenerator::generate(params, coarseWarp ? &warpField : nullptr, 1, result);
+    if (result.width != (int)width)
+        resize(result.width);
+    applyHeightmap(result);
+    erosionManager.clean();
+    erosionManager.init(this);
+}
 
-            if (domainWarpAmplitude > 0.0f) {
-                dx = domainWarpAmplitude * perlinOctave(6.0f, 0.001f, 0.5f, 2.0f, (float)x - 1.4f, (float)z - 4.7f);
-                dz = domainWarpAmplitude * perlinOctave(6.0f, 0.001f, 0.5f, 2.0f, (float)x + 5.2f, (float)z + 1.3f);
-            }
+void Terrain::requestHeightmap(int width_) {
+    // restarts generation if one is already in progress, the previous terrain is drawn until a result arrives
+    generator.start(getHeightmapParams(width_));
+}
 
-            // get noise values at current x,z coordinate
-            const float baseNoise = perlinOctave(4.0f, frequency, 0.5f, 2.0f,
-                (x * scale) + ((float)seed) * width, (z * scale) + ((float)seed) * width);
-            const float mountainNoise = perlinOctave(nOctaves, frequency, persistence, lacunarity,
-                ((x + dx) * scale) + ((float)seed + 1.0f) * width, ((z + dz) * scale) + ((float)seed + 1.0f) * width);
-            
-            // use noise value to get a height
-            const float height = minHeight + baseNoise * std::pow(mountainNoise, 2.0f) * amplitude;
-            heightmap[(z * width) + x] = height;
-            altitude[(z * width) + x] = height;
-            
-            if (height > heightMaxAtomic) {
-                heightMaxAtomic = height;
-            }
-        }
+bool Terrain::updateHeightmap() {
+    // apply the latest generated heightmap, returns true once the full resolution heightmap is in place
+    // the heights are applied and meshed on the scheduler, this thread only resizes GL objects and uploads the result
+    if (preparing.valid()) {
+        if (preparing.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+        preparing.get();
+        sendMeshGPU();
+
+        // erosion buffers are only set up for the full resolution heightmap, GL backends release theirs here
+        if (generatorResult.stride != 1)
+            return false;
+        erosionManager.clean();
+        erosionManager.init(this);
+        return true;
     }
-    maxHeight = heightMaxAtomic;
 
-    // place trees
+    if (!generator.poll(generatorResult))
+        return false;
+    if (generatorResult.width != (int)width)
+        resize(generatorResult.width);
+    preparing = TaskScheduler::get().submit([this] {
+        applyHeightmap(generatorResult);
+        generateMesh(false);
+    }, TaskScheduler::LOW);
+    return false;
+}
+
+void Terrain::resize(int width_) {
+    // GL objects are recreated, so this runs on the render thread
+    if (width != 0)
+        clean();
+    width = width_;
+    size = width * width;
+    resizeGrid(water, size, width);
+    resizeGrid(altitude, size, width);
+    terrainMesh.init(1.0f, width, width);
+    resizeWater();
+    lod.init(width);
     trees.init(12.0f, 8.0f);
+}
+
+void Terrain::applyHeightmap(HeightmapResult& result) {
+    // no GL calls, so it can run on the scheduler while the last terrain is still drawn
+    std::fill(water.begin(), water.end(), 0.0f);
+
+    heightmap.swap(result.heights);
+    // water and sediment left by the last run belong to the old heights
+    erosionManager.resumable = false;
+    copyGrid(heightmap.data(), altitude, width);
+    maxHeight = result.maxHeight;
+    terrainMesh.setMaxHeight(maxHeight);
+
+    // trees are only placed on the full resolution heightmap
+    {
+        std::lock_guard<std::mutex> lock(treeMutex);
+        treeIndexes.clear();
+        treePositions.clear();
+        treesUpdated = true;
+        if (result.stride == 1)
+            placeTrees();
+    }
+}
+
+void Terrain::placeTrees() {
     for (int z = 1; z < width - 1; z += TREE_MIN_DISTANCE) {
         for (int x = 1; x < width - 1; x += TREE_MIN_DISTANCE) {
             const int cellIndex = z * width + x;
@@ -69,90 +136,230 @@ void Terrain::generateHeightmap(int width_) {
         }
     }
     treesUpdated = true;
+}
 
-    // initialise meshes and erosion manager
-    terrainMesh.init(1.0f, width, width);
-    waterMesh.init(1.0f, width, width);
-    erosionManager.init(this);
+void Terrain::generateMesh(bool genWater, const DirtyTiles* dirty){
+    generateMesh(heightmap.data(), water.data(), genWater, dirty);
 }
 
-void Terrain::generateMesh(bool genWater){
-    terrainMesh.generate(altitude.data(), heightmap.data());
+void Terrain::generateMesh(const float* heights, const float* waterDepths, bool genWater, const DirtyTiles* dirty){
+    // meshes are built from the given state, a snapshot while eroding so the simulation can carry on
+    // only tiles marked dirty are rebuilt, everything if none are given
+    terrainMesh.generate(altitude.data(), heights, dirty);
+    lod.updateBounds(heights, dirty);
 
     // generate water mesh
     if (genWater) {
-        generateWaterMesh();
+        generateWaterMesh(heights, waterDepths, dirty);
     }
 
-    // update trees
-    auto indexIterator = treeIndexes.begin();
-    auto posIterator = treePositions.begin();
-    const Vec3* terrainNormals = terrainMesh.getNormals();
-    while (indexIterator != treeIndexes.end()) {
-        const int index = *indexIterator;
+    // update trees, the survivors are collected aside and swapped in whole as the render thread may be uploading the lists
+    std::vector<int> keptIndexes;
+    std::vector<Vec3> keptPositions;
+    keptIndexes.reserve(treeIndexes.size());
+    keptPositions.reserve(treePositions.size());
+    for (size_t i = 0; i < treeIndexes.size(); i++) {
+        const int index = treeIndexes[i];
         
-        // calculate grass weight
-        const float grad = abs(dot(terrainNormals[index], Vec3{ 0.0f, 1.0f, 0.0f }));
-        float grassWeight = hermite(grad, 0.5f, 0.75f) * (1.0f - hermite(heightmap[index], 75.0f, 90.0f));
-        grassWeight *= 1.0f - hermite(abs(altitude[index] - heightmap[index]), 0.0, 0.1f);
-
-        if (grassWeight < 0.5f) {
-            indexIterator = treeIndexes.erase(indexIterator);
-            posIterator = treePositions.erase(posIterator);
-            treesUpdated = true;
-        }
-        else {
-            ++indexIterator;
-            ++posIterator;
+        // calculate grass weight, trees are never on the border so the normal can use central differences
+        const Vec3 normal = normalize(Vec3{ heights[index - 1] - heights[index + 1], 2.0f,
+            heights[index - width] - heights[index + width] });
+        const float grad = abs(dot(normal, Vec3{ 0.0f, 1.0f, 0.0f }));
+        float grassWeight = hermite(grad, 0.5f, 0.75f) * (1.0f - hermite(heights[index], 75.0f, 90.0f));
+        grassWeight *= 1.0f - hermite(abs(altitude[index] - heights[index]), 0.0, 0.1f);
+
+        if (grassWeight >= 0.5f) {
+            keptIndexes.push_back(index);
+            keptPositions.push_back(treePositions[i]);
         }
     }
+    if (keptIndexes.size() != treeIndexes.size()) {
+        std::lock_guard<std::mutex> lock(treeMutex);
+        treeIndexes.swap(keptIndexes);
+        treePositions.swap(keptPositions);
+        treesUpdated = true;
+    }
+
+    // published last, so the set is only uploaded once every part of it is built
+    meshSetReady = true;
 }
 
-void Terrain::generateWaterMesh() {
-    float* waterHeights = new float[(width * width)];
-    float* smoothedHeights = new float[(width * width)];
+void Terrain::resizeWater() {
+    // the water grid has a vertex every waterDivisor cells, the last one clamped to the terrain's edge
+    waterWidth = (width - 1 + waterDivisor - 1) / waterDivisor + 1;
+    resizeGrid(waterSurface, waterWidth * waterWidth, waterWidth);
+    surfaceTiles = DirtyTiles();
+    waterMesh.init(1.0f, waterWidth, waterWidth);
+}
 
-#pragma omp parallel for
-    for (int i = 0; i < (width*width); i++) {
-        waterHeights[i] = heightmap[i] + water[i];
-    }
-    
-    // smooth heights to improve water visuals
-#pragma omp parallel for
-    for (int z = 1; z < width - 1; z++) {
-        for (int x = 1; x < width - 1; x++) {
-            const float smoothedHeight = (
-                 waterHeights[(z - 1) * width + x - 1] +
-                 waterHeights[(z - 1) * width + x] +
-                 waterHeights[(z - 1) * width + x + 1] +
-                 waterHeights[z * width + x - 1] +
-                 waterHeights[z * width + x] +
-                 waterHeights[z * width + x + 1] +
-                 waterHeights[(z + 1) * width + x - 1] +
-                 waterHeights[(z + 1) * width + x] +
-                 waterHeights[(z + 1) * width + x + 1]
-             ) / 9.0f;
-            smoothedHeights[z * width + x] = smoothedHeight;
+void Terrain::setWaterResolution(int divisor) {
+    if (divisor == waterDivisor)
+        return;
+    waterDivisor = divisor;
+    waterMesh.clean();
+    resizeWater();
+    generateWaterMesh();
+    meshSetReady = true;
+}
+
+void Terrain::generateWaterMesh(const DirtyTiles* dirty) {
+    generateWaterMesh(heightmap.data(), water.data(), dirty);
+}
+
+void Terrain::generateWaterMesh(const float* heights, const float* waterDepths, const DirtyTiles* dirty) {
+    constexpr int TILE_SIZE = DirtyTiles::TILE_SIZE;
+    const int tileCells = TILE_SIZE * waterDivisor; // terrain cells under one water tile
+    const int radius = waterDivisor; // filter taps either side, a 3x3 box at full resolution
+    const int lastCell = (int)width - 1;
+
+    // a tile is wet if any cell under its quads holds water
+    DirtyTiles wet;
+    wet.resize(waterWidth, waterWidth);
+    TaskScheduler::get().parallelFor(0, wet.tilesX * wet.tilesZ, [&](int tile) {
+        const int tileX = tile % wet.tilesX;
+        const int tileZ = tile / wet.tilesX;
+        bool wetTile = false;
+        for (int z = tileZ * tileCells; z <= std::min((tileZ + 1) * tileCells, lastCell) && !wetTile; z++) {
+            for (int x = tileX * tileCells; x <= std::min((tileX + 1) * tileCells, lastCell); x++) {
+                if (waterDepths[z * width + x] > WET_EPSILON) {
+                    wetTile = true;
+                    break;
+                }
+            }
+        }
+        if (wetTile)
+            wet.markTile(tileX, tileZ);
+    }, TaskScheduler::HIGH);
+
+    // a water tile changes when any terrain tile its filter reads from is dirty
+    auto footprintDirty = [&](int tileX, int tileZ) {
+        if (!dirty)
+            return true;
+        const int x0 = std::max(tileX * tileCells - radius, 0) / TILE_SIZE;
+        const int z0 = std::max(tileZ * tileCells - radius, 0) / TILE_SIZE;
+        const int x1 = std::min(((tileX + 1) * tileCells + radius) / TILE_SIZE, dirty->tilesX - 1);
+        const int z1 = std::min(((tileZ + 1) * tileCells + radius) / TILE_SIZE, dirty->tilesZ - 1);
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) {
+                if (dirty->tileDirty(x, z))
+                    return true;
+            }
+        }
+        return false;
+    };
+
+    // the surface is kept around wet tiles too so normals along their edges are valid
+    // tiles newly joining the surface have stale heights and are rebuilt whatever changed
+    const DirtyTiles surface = wet.dilated();
+    DirtyTiles changed = surface;
+    if (surfaceTiles.tilesX != surface.tilesX)
+        surfaceTiles.resize(waterWidth, waterWidth);
+    for (int tileZ = 0; tileZ < changed.tilesZ; tileZ++) {
+        for (int tileX = 0; tileX < changed.tilesX; tileX++) {
+            const int i = tileZ * changed.tilesX + tileX;
+            changed.flags[i] = surface.flags[i] && (!surfaceTiles.flags[i] || footprintDirty(tileX, tileZ));
         }
     }
-    
-    waterMesh.generate(terrainMesh.getVBO(), smoothedHeights);
-    
-    delete[] waterHeights;
-    delete[] smoothedHeights;
+    surfaceTiles = surface;
+
+    // downsample the water surface with a separable box filter, a strip of tiles at a time
+    // filtered rows are kept in per thread scratch that is only allocated when it grows
+    const int stripRows = (TILE_SIZE - 1) * waterDivisor + 2 * radius + 1;
+    const size_t stripSize = (size_t)stripRows * waterWidth;
+    const float weight = 1.0f / ((2 * radius + 1) * (2 * radius + 1));
+
+    TaskScheduler::get().parallelFor(0, changed.tilesZ, [&](int tileZ) {
+        if (!changed.rowDirty(tileZ))
+            return;
+        thread_local std::vector<float> waterFilterScratch;
+        if (waterFilterScratch.size() < stripSize)
+            waterFilterScratch.resize(stripSize);
+        float* rows = waterFilterScratch.data();
+        const int vz0 = tileZ * TILE_SIZE;
+        const int vz1 = std::min(vz0 + TILE_SIZE, (int)waterWidth);
+        const int zBegin = std::min(vz0 * waterDivisor, lastCell) - radius;
+        const int zEnd = std::min((vz1 - 1) * waterDivisor, lastCell) + radius;
+
+        // horizontal pass, summing terrain and water along each terrain row the strip reads
+        for (int z = zBegin; z <= zEnd; z++) {
+            const int row = std::clamp(z, 0, lastCell) * width;
+            float* out = rows + (z - zBegin) * waterWidth;
+            for (int tileX = 0; tileX < changed.tilesX; tileX++) {
+                if (!changed.tileDirty(tileX, tileZ))
+                    continue;
+                for (int vx = tileX * TILE_SIZE; vx < std::min((tileX + 1) * TILE_SIZE, (int)waterWidth); vx++) {
+                    const int cx = std::min(vx * waterDivisor, lastCell);
+                    float total = 0.0f;
+                    for (int dx = -radius; dx <= radius; dx++) {
+                        const int cellIndex = row + std::clamp(cx + dx, 0, lastCell);
+                        total += heights[cellIndex] + waterDepths[cellIndex];
+                    }
+                    out[vx] = total;
+                }
+            }
+        }
+
+        // vertical pass over the filtered rows
+        for (int vz = vz0; vz < vz1; vz++) {
+            const int centre = std::min(vz * waterDivisor, lastCell) - zBegin;
+            for (int tileX = 0; tileX < changed.tilesX; tileX++) {
+                if (!changed.tileDirty(tileX, tileZ))
+                    continue;
+                for (int vx = tileX * TILE_SIZE; vx < std::min((tileX + 1) * TILE_SIZE, (int)waterWidth); vx++) {
+                    float total = 0.0f;
+                    for (int dz = -radius; dz <= radius; dz++) {
+                        total += rows[(centre + dz) * waterWidth + vx];
+                    }
+                    waterSurface[vz * waterWidth + vx] = total * weight;
+                }
+            }
+        }
+    }, TaskScheduler::HIGH);
+
+    waterMesh.generate(waterSurface.data(), &changed);
+    waterMesh.setWetTiles(wet);
 }
 
 void Terrain::sendMeshGPU() {
+    // only whole sets are uploaded, so a frame never shows terrain from one state with water or trees from another
+    if (!meshSetReady)
+        return;
     if (terrainMesh.needSendGPU) {
         terrainMesh.sendGPU();
     }
     if (waterMesh.needSendGPU) {
         waterMesh.sendGPU();
     }
-    if (treesUpdated) {
-        trees.setPositions(treePositions);
-        treesUpdated = false;
+    {
+        std::lock_guard<std::mutex> lock(treeMutex);
+        if (treesUpdated) {
+            trees.setPositions(treePositions);
+            treesUpdated = false;
+        }
     }
+    meshSetReady = false;
+
+    // wake threads waiting for the meshes to be consumed
+    meshHandoff.notify();
+}
+
+void Terrain::renderTerrainLod(const Mat4& mvp, const Vec3& cameraPosition) {
+    // heights are read from the full resolution mesh's buffer, only the patches drawn over them change
+    terrainMesh.bind();
+    lod.select(mvp, cameraPosition, scale);
+    lod.render();
+
+    // the terrain's depth occludes patches drawn next frame
+    lod.buildHiZ();
+}
+
+void Terrain::renderWater() {
+    // water reads the quantised terrain heights per fragment for its shoreline and transparency
+    terrainMesh.bindHeights(WaterMesh::TERRAIN_HEIGHTS_BINDING);
+    glUniform2f(WaterMesh::TERRAIN_HEIGHT_RANGE_LOCATION, terrainMesh.getHeightMin(), terrainMesh.getHeightMax());
+    glUniform1i(WaterMesh::CELL_SCALE_LOCATION, waterDivisor);
+    glUniform1i(WaterMesh::TERRAIN_SIZE_LOCATION, width);
+    waterMesh.render();
 }
 
 void Terrain::updateAltitude() {
@@ -164,11 +371,17 @@ void Terrain::updateAltitude() {
 }
 
 void Terrain::clean(){
+    if (preparing.valid())
+        preparing.get();
     terrainMesh.clean();
     waterMesh.clean();
+    lod.clean();
     trees.clean();
 
-    treeIndexes.clear();
-    treePositions.clear();
+    {
+        std::lock_guard<std::mutex> lock(treeMutex);
+        treeIndexes.clear();
+        treePositions.clear();
+    }
     erosionManager.clean();
 }
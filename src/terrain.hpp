@@ -5,22 +5,41 @@
 #include "heightMesh.hpp"
 #include "waterMesh.hpp"
 #include "terrainMesh.hpp"
+#include "terrainLod.hpp"
 #include "shaderProgram.hpp"
 #include "tree.hpp"
 #include "erosionManager.hpp"
+#include "noise.hpp"
+#include "heightmapGenerator.hpp"
+#include "gridMemory.hpp"
+#include "signal.hpp"
 
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <future>
 
 class Terrain {
 private:
     static constexpr int TREE_MIN_DISTANCE = 4;
     static constexpr int TREE_CHANCE = 10;
     static constexpr float TERRAIN_BIAS = 0.025f;
+    static constexpr float WET_EPSILON = 0.001f; // water depth below which a cell is treated as dry
 
     TerrainMesh terrainMesh;
     WaterMesh waterMesh;
+    TerrainLod lod;
     InstancedTree trees;
+
+    // asynchronous heightmap generation, results are applied and meshed on the scheduler and only uploaded here
+    HeightmapGenerator generator;
+    HeightmapResult generatorResult;
+    std::future<void> preparing;
+
+    void resize(int);
+    void applyHeightmap(HeightmapResult&);
+    void resizeWater();
+    void placeTrees();
 public:
     // heightmap parameters
     unsigned int width = 0;
@@ -33,16 +52,23 @@ public:
     float lacunarity = 2.0f;
     int seed = 0;
     float domainWarpAmplitude = 400.0f;
+    int domainWarpResolution = 1; // warp field is sampled every n cells and upsampled
     float maxHeight = 0.0f;
     float minHeight = 30.0f;
+    NoiseBasis noiseBasis = NoiseBasis::PERLIN;
 
     ErosionManager erosionManager;
     
-    std::vector<float> heightmap;
-    std::vector<float> water;
-    std::vector<float> altitude;
+    Grid<float> heightmap;
+    Grid<float> water;
+    Grid<float> altitude;
+    Grid<float> waterSurface; // smoothed heights of the water surface
+    DirtyTiles surfaceTiles; // tiles of waterSurface that are up to date, wet tiles and their neighbours
+    unsigned int waterWidth = 0;
+    int waterDivisor = 2; // terrain cells between water vertices
     std::vector<Vec3> treePositions;
     std::vector<int> treeIndexes;
+    std::mutex treeMutex; // held while the tree lists are replaced or uploaded
 
     // threadsafe flags
     std::atomic<bool> showErosion = true;
@@ -50,29 +76,47 @@ public:
     std::atomic<bool> showTrees = true;
     std::atomic<bool> stopEroding = false;
     std::atomic<bool> treesUpdated = false;
+    std::atomic<bool> meshSetReady = false; // terrain, water and trees built from one state, waiting for upload
+
+    // notified whenever meshes are uploaded, a snapshot is published for meshing or erosion stops
+    Signal meshHandoff;
 
     Terrain() = default;
     Terrain(unsigned int, float);
     void generateHeightmap(int);
-    void generateMesh(bool genWater=false);
-    void generateWaterMesh();
+    void requestHeightmap(int);
+    bool updateHeightmap();
+    HeightmapParams getHeightmapParams(int) const;
+    void generateMesh(bool genWater=false, const DirtyTiles* dirty=nullptr);
+    void generateMesh(const float* heights, const float* waterDepths, bool genWater, const DirtyTiles* dirty);
+    void generateWaterMesh(const DirtyTiles* dirty=nullptr);
+    void generateWaterMesh(const float* heights, const float* waterDepths, const DirtyTiles* dirty);
+    void setWaterResolution(int);
     void sendMeshGPU();
     void updateAltitude();
     void clean();
 
+    inline bool isGenerating() const;
     inline bool needMeshSentGPU() const;
     inline float getLastHmapGenTime() const;
     inline float getLastErosionTime() const;
     inline bool getErosionStatus() const;
     inline void setErosionStatus(bool status_);
     inline void renderTerrain();
-    inline void renderWater();
+    void renderTerrainLod(const Mat4& mvp, const Vec3& cameraPosition);
+    inline TerrainLod& getLod();
+    void renderWater();
     inline void renderTrees();
 };
 
-// if meshes are pending a GPU send
+// if a heightmap is being generated in the background
+bool Terrain::isGenerating() const {
+    return generator.busy() || preparing.valid();
+}
+
+// if a set of meshes is pending a GPU send
 bool Terrain::needMeshSentGPU() const {
-    return terrainMesh.needSendGPU || waterMesh.needSendGPU || treesUpdated;
+    return meshSetReady;
 }
 
 bool Terrain::getErosionStatus() const {
@@ -87,8 +131,8 @@ void Terrain::renderTerrain() {
     terrainMesh.render();
 }
 
-void Terrain::renderWater() {
-    waterMesh.render();
+TerrainLod& Terrain::getLod() {
+    return lod;
 }
 
 void Terrain::renderTrees() {
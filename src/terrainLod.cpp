@@ -0,0 +1,373 @@
+#include "terrainLod.hpp"
+#include "taskScheduler.hpp"
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+TerrainLod::~TerrainLod() {
+    clean();
+}
+
+void TerrainLod::init(int width_) {
+    std::lock_guard<std::mutex> lock(boundsMutex);
+    width = width_;
+
+    // levels are added until a single node covers the grid
+    levelNodes.clear();
+    int nodes = std::max((width - 1 + PATCH_SIZE - 1) / PATCH_SIZE, 1);
+    levelNodes.push_back(nodes);
+    while (nodes > 1 && (int)levelNodes.size() < MAX_LEVELS) {
+        nodes = (nodes + 1) / 2;
+        levelNodes.push_back(nodes);
+    }
+    nLevels = (int)levelNodes.size();
+
+    bounds.resize(nLevels);
+    for (int level = 0; level < nLevels; level++) {
+        bounds[level].assign(levelNodes[level] * levelNodes[level], { 0.0f, 0.0f });
+    }
+    selected.clear();
+}
+
+void TerrainLod::updateBounds(const float* heights, const DirtyTiles* dirty) {
+    if (nLevels == 0)
+        return;
+
+    // a leaf also covers the first row and column of the next tile, so is rebuilt when either is dirty
+    const int leaves = levelNodes[0];
+    auto leafDirty = [&](int x, int z) {
+        if (!dirty)
+            return true;
+        for (int tileZ = z; tileZ <= std::min(z + 1, dirty->tilesZ - 1); tileZ++) {
+            for (int tileX = x; tileX <= std::min(x + 1, dirty->tilesX - 1); tileX++) {
+                if (dirty->tileDirty(tileX, tileZ))
+                    return true;
+            }
+        }
+        return false;
+    };
+
+    std::vector<HeightBounds> leafBounds;
+    {
+        std::lock_guard<std::mutex> lock(boundsMutex);
+        leafBounds = bounds[0];
+    }
+
+    TaskScheduler::get().parallelFor(0, leaves, [&](int z) {
+        for (int x = 0; x < leaves; x++) {
+            if (!leafDirty(x, z))
+                continue;
+            HeightBounds leaf{ std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest() };
+            for (int j = z * PATCH_SIZE; j <= std::min((z + 1) * PATCH_SIZE, width - 1); j++) {
+                for (int i = x * PATCH_SIZE; i <= std::min((x + 1) * PATCH_SIZE, width - 1); i++) {
+                    leaf.min = std::min(leaf.min, heights[j * width + i]);
+                    leaf.max = std::max(leaf.max, heights[j * width + i]);
+                }
+            }
+            leafBounds[z * leaves + x] = leaf;
+        }
+    }, TaskScheduler::HIGH);
+
+    // parents are the union of their children, cheap enough to rebuild whole
+    std::lock_guard<std::mutex> lock(boundsMutex);
+    bounds[0].swap(leafBounds);
+    for (int level = 1; level < nLevels; level++) {
+        const int nodes = levelNodes[level];
+        const int childNodes = levelNodes[level - 1];
+        for (int z = 0; z < nodes; z++) {
+            for (int x = 0; x < nodes; x++) {
+                HeightBounds node{ std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest() };
+                for (int cz = 2 * z; cz <= std::min(2 * z + 1, childNodes - 1); cz++) {
+                    for (int cx = 2 * x; cx <= std::min(2 * x + 1, childNodes - 1); cx++) {
+                        const HeightBounds& child = bounds[level - 1][cz * childNodes + cx];
+                        node.min = std::min(node.min, child.min);
+                        node.max = std::max(node.max, child.max);
+                    }
+                }
+                bounds[level][z * nodes + x] = node;
+            }
+        }
+    }
+}
+
+void TerrainLod::extractPlanes(const Mat4& m) {
+    // clip space planes of a row major matrix, in the grid space the matrix transforms from
+    const float rows[4][4] = {
+        { m.m00, m.m01, m.m02, m.m03 },
+        { m.m10, m.m11, m.m12, m.m13 },
+        { m.m20, m.m21, m.m22, m.m23 },
+        { m.m30, m.m31, m.m32, m.m33 }
+    };
+    for (int i = 0; i < 6; i++) {
+        const float sign = i % 2 == 0 ? 1.0f : -1.0f;
+        const float* row = rows[i / 2];
+        planes[i] = Vec3{ rows[3][0] + sign * row[0], rows[3][1] + sign * row[1], rows[3][2] + sign * row[2] };
+        planeDistances[i] = rows[3][3] + sign * row[3];
+    }
+}
+
+bool TerrainLod::inFrustum(int x0, int z0, int x1, int z1, const HeightBounds& height) const {
+    // the box is outside if its corner furthest along any plane's normal is behind it
+    for (int i = 0; i < 6; i++) {
+        const Vec3& n = planes[i];
+        const float px = n.x > 0.0f ? (float)x1 : (float)x0;
+        const float py = n.y > 0.0f ? height.max : height.min;
+        const float pz = n.z > 0.0f ? (float)z1 : (float)z0;
+        if (n.x * px + n.y * py + n.z * pz + planeDistances[i] < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+void TerrainLod::selectNode(int level, int x, int z, const Vec3& camera, float scale) {
+    const int cells = PATCH_SIZE << level;
+    const int x0 = x * cells;
+    const int z0 = z * cells;
+    if (x0 >= width - 1 || z0 >= width - 1)
+        return;
+    const int x1 = std::min(x0 + cells, width - 1);
+    const int z1 = std::min(z0 + cells, width - 1);
+
+    const HeightBounds& height = bounds[level][z * levelNodes[level] + x];
+    if (!inFrustum(x0, z0, x1, z1, height))
+        return;
+
+    // subdivide while any of the node is within range of the finer level
+    if (level > 0) {
+        const float dx = std::max({ x0 * scale - camera.x, 0.0f, camera.x - x1 * scale });
+        const float dy = std::max({ height.min - camera.y, 0.0f, camera.y - height.max });
+        const float dz = std::max({ z0 * scale - camera.z, 0.0f, camera.z - z1 * scale });
+        if (dx * dx + dy * dy + dz * dz < ranges[level - 1] * ranges[level - 1]) {
+            // children beyond their own range are fully morphed, so match this level along their edges
+            for (int child = 0; child < 4; child++) {
+                selectNode(level - 1, 2 * x + child % 2, 2 * z + child / 2, camera, scale);
+            }
+            return;
+        }
+    }
+
+    selected.push_back(Node{ (float)x0, (float)z0, (float)(1 << level), 0.0f,
+        ranges[level] * MORPH_START, ranges[level], height.min, height.max });
+}
+
+void TerrainLod::select(const Mat4& mvp, const Vec3& cameraPosition, float scale) {
+    selected.clear();
+    if (nLevels == 0)
+        return;
+
+    extractPlanes(mvp);
+    cullMatrix = mvp;
+    for (int level = 0; level < nLevels; level++) {
+        ranges[level] = lodDistance * (float)(1 << level);
+    }
+    // the coarsest level is never morphed further
+    ranges[nLevels - 1] = std::numeric_limits<float>::max();
+
+    std::lock_guard<std::mutex> lock(boundsMutex);
+    const int top = nLevels - 1;
+    for (int z = 0; z < levelNodes[top]; z++) {
+        for (int x = 0; x < levelNodes[top]; x++) {
+            selectNode(top, x, z, cameraPosition, scale);
+        }
+    }
+}
+
+void TerrainLod::render() {
+    if (!VAO) {
+        // a single patch of indices is shared by every node, vertex positions come from the node and vertex id
+        std::vector<uint16_t> indices;
+        indices.reserve(PATCH_SIZE * PATCH_SIZE * 6);
+        for (int z = 0; z < PATCH_SIZE; z++) {
+            for (int x = 0; x < PATCH_SIZE; x++) {
+                const uint16_t corner = (uint16_t)(z * (PATCH_SIZE + 1) + x);
+                const uint16_t below = (uint16_t)(corner + PATCH_SIZE + 1);
+                indices.insert(indices.end(), { corner, below, (uint16_t)(below + 1), corner, (uint16_t)(below + 1), (uint16_t)(corner + 1) });
+            }
+        }
+        numIndices = (int)indices.size();
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &EBO);
+        glGenBuffers(1, &nodeBuffer);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    if (selected.empty())
+        return;
+
+    // nodes are rewritten every frame, orphaning the storage so the previous frame's draw is not waited on
+    if (selected.size() > nodeCapacity)
+        nodeCapacity = selected.size() * 2;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, nodeCapacity * sizeof(Node), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, selected.size() * sizeof(Node), selected.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (gpuCulling) {
+        cullOnGPU();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_BINDING, visibleBuffer);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+        return;
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_BINDING, nodeBuffer);
+    glBindVertexArray(VAO);
+    glDrawElementsInstanced(GL_TRIANGLES, numIndices, GL_UNSIGNED_SHORT, 0, (GLsizei)selected.size());
+    glBindVertexArray(0);
+}
+
+void TerrainLod::cullOnGPU() {
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    if (!cullShader) {
+        cullShader = new ShaderProgram(std::vector<Shader>{
+            {"res/shaders/terrainCull.comp", GL_COMPUTE_SHADER}});
+        glGenBuffers(1, &visibleBuffer);
+        glGenBuffers(1, &commandBuffer);
+    }
+
+    // the instance count is accumulated by the cull pass
+    const GLuint command[5] = { (GLuint)numIndices, 0, 0, 0, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(command), command, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, nodeCapacity * sizeof(Node), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glUseProgram(cullShader->glID);
+    glUniformMatrix4fv(0, 1, GL_TRUE, &cullMatrix.m00);
+    glUniform1i(1, (int)selected.size());
+    glUniform1i(2, width);
+    glUniform1i(3, PATCH_SIZE);
+    glUniform1i(4, hiZValid);
+    glUniformMatrix4fv(5, 1, GL_TRUE, &hiZMatrix.m00);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_BINDING, nodeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE_NODES_BINDING, visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, commandBuffer);
+    glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, hiZTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    glDispatchCompute(((int)selected.size() + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    glUseProgram(program);
+}
+
+void TerrainLod::createHiZ(int w, int h) {
+    if (hiZTexture) {
+        glDeleteTextures(1, &hiZTexture);
+        glDeleteTextures(1, &depthCopy);
+    }
+    hiZWidth = w;
+    hiZHeight = h;
+    hiZLevels = 1;
+    while ((std::max(w, h) >> hiZLevels) > 0) {
+        hiZLevels++;
+    }
+
+    glGenTextures(1, &depthCopy);
+    glBindTexture(GL_TEXTURE_2D, depthCopy);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, w, h);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &hiZTexture);
+    glBindTexture(GL_TEXTURE_2D, hiZTexture);
+    glTexStorage2D(GL_TEXTURE_2D, hiZLevels, GL_R32F, w, h);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    hiZValid = false;
+}
+
+void TerrainLod::buildHiZ() {
+    // expects only the terrain to have been drawn in to the depth buffer, it is the occluder for the next frame
+    if (!gpuCulling) {
+        hiZValid = false;
+        return;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] <= 0 || viewport[3] <= 0)
+        return;
+    if (viewport[2] != hiZWidth || viewport[3] != hiZHeight)
+        createHiZ(viewport[2], viewport[3]);
+
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    if (!hiZShader) {
+        hiZShader = new ShaderProgram(std::vector<Shader>{
+            {"res/shaders/hiZ.comp", GL_COMPUTE_SHADER}});
+    }
+
+    glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, depthCopy);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], hiZWidth, hiZHeight);
+
+    // level 0 is the depth buffer itself, every level above keeps the furthest depth it covers
+    glUseProgram(hiZShader->glID);
+    for (int level = 0; level < hiZLevels; level++) {
+        const int w = std::max(hiZWidth >> level, 1);
+        const int h = std::max(hiZHeight >> level, 1);
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? depthCopy : hiZTexture);
+        glUniform1i(0, level - 1);
+        glUniform2i(1, std::max(hiZWidth >> std::max(level - 1, 0), 1), std::max(hiZHeight >> std::max(level - 1, 0), 1));
+        glUniform1i(2, level > 0);
+        glBindImageTexture(0, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((w + HIZ_WORKGROUP_SIZE - 1) / HIZ_WORKGROUP_SIZE, (h + HIZ_WORKGROUP_SIZE - 1) / HIZ_WORKGROUP_SIZE, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(program);
+    // the depth was drawn with the matrix selected this frame
+    hiZMatrix = cullMatrix;
+    hiZValid = true;
+}
+
+void TerrainLod::clean() {
+    if (VAO) {
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &nodeBuffer);
+        glDeleteVertexArrays(1, &VAO);
+    }
+    if (cullShader) {
+        glDeleteBuffers(1, &visibleBuffer);
+        glDeleteBuffers(1, &commandBuffer);
+    }
+    if (hiZTexture) {
+        glDeleteTextures(1, &hiZTexture);
+        glDeleteTextures(1, &depthCopy);
+    }
+
+    // shader programs delete themselves on destruction
+    delete cullShader;
+    delete hiZShader;
+    cullShader = nullptr;
+    hiZShader = nullptr;
+
+    VAO = 0;
+    EBO = 0;
+    nodeBuffer = 0;
+    nodeCapacity = 0;
+    numIndices = 0;
+    visibleBuffer = 0;
+    commandBuffer = 0;
+    hiZTexture = 0;
+    depthCopy = 0;
+    hiZWidth = 0;
+    hiZHeight = 0;
+    hiZLevels = 0;
+    hiZValid = false;
+    selected.clear();
+}
@@ -0,0 +1,97 @@
+#ifndef TERRAIN_LOD_HPP_INCLUDED
+#define TERRAIN_LOD_HPP_INCLUDED
+
+#include "mat4.hpp"
+#include "vec3.hpp"
+#include "dirtyTiles.hpp"
+#include "shaderProgram.hpp"
+
+#include <vector>
+#include <mutex>
+
+// continuous distance based level of detail over a quadtree of fixed size grid patches
+// each level doubles the cells a patch covers, patches morph towards the next level before switching to it
+class TerrainLod {
+public:
+    static constexpr int PATCH_SIZE = 32; // quads along each side of a patch
+    static constexpr int MAX_LEVELS = 12;
+    static constexpr unsigned int NODES_BINDING = 11;
+    static constexpr unsigned int VISIBLE_NODES_BINDING = 12;
+    static constexpr unsigned int COMMAND_BINDING = 13;
+    static constexpr int HIZ_TEXTURE_UNIT = 8; // above the terrain material textures
+    static constexpr int CULL_WORKGROUP_SIZE = 64;
+    static constexpr int HIZ_WORKGROUP_SIZE = 8;
+    static constexpr float MORPH_START = 0.7f; // fraction of a level's range where morphing to the next level begins
+    static_assert(PATCH_SIZE == DirtyTiles::TILE_SIZE, "leaf bounds are rebuilt per dirty tile");
+
+    // matches the node struct in terrainLod.vert
+    struct Node {
+        float x, z;
+        float step; // cells between patch vertices
+        float padding0;
+        float morphStart, morphEnd;
+        float minHeight, maxHeight; // bounds tested when culling on the GPU
+    };
+private:
+    struct HeightBounds {
+        float min;
+        float max;
+    };
+
+    int width = 0;
+    int nLevels = 0;
+    std::vector<int> levelNodes; // nodes along each side of a level
+    std::vector<std::vector<HeightBounds>> bounds; // min max pyramid, leaves first
+    std::mutex boundsMutex; // bounds are rebuilt by the erosion thread while the render thread selects
+
+    float ranges[MAX_LEVELS] = {};
+    Vec3 planes[6] = {};
+    float planeDistances[6] = {};
+    std::vector<Node> selected;
+
+    unsigned int VAO = 0;
+    unsigned int EBO = 0;
+    unsigned int nodeBuffer = 0;
+    size_t nodeCapacity = 0;
+    int numIndices = 0;
+
+    // GPU culling, nodes passing the frustum and occlusion tests are compacted in to a buffer drawn indirectly
+    Mat4 cullMatrix{};
+    ShaderProgram* cullShader = nullptr;
+    ShaderProgram* hiZShader = nullptr;
+    unsigned int visibleBuffer = 0;
+    unsigned int commandBuffer = 0;
+
+    // furthest depth pyramid of the previous frame's terrain, and the matrix it was drawn with to reproject nodes in to it
+    Mat4 hiZMatrix{};
+    unsigned int depthCopy = 0;
+    unsigned int hiZTexture = 0;
+    int hiZWidth = 0;
+    int hiZHeight = 0;
+    int hiZLevels = 0;
+    bool hiZValid = false;
+
+    void createHiZ(int, int);
+    void cullOnGPU();
+
+    void extractPlanes(const Mat4&);
+    bool inFrustum(int x0, int z0, int x1, int z1, const HeightBounds&) const;
+    void selectNode(int level, int x, int z, const Vec3& camera, float scale);
+public:
+    float lodDistance = 48.0f; // world distance covered by the finest level
+    bool gpuCulling = false;
+
+    TerrainLod() = default;
+    TerrainLod(const TerrainLod&) = delete;
+    ~TerrainLod();
+
+    void init(int width_);
+    void updateBounds(const float* heights, const DirtyTiles* dirty = nullptr);
+    void select(const Mat4& mvp, const Vec3& cameraPosition, float scale);
+    void render();
+    void buildHiZ();
+    void clean();
+    inline int getNodeCount() const { return (int)selected.size(); }
+};
+
+#endif
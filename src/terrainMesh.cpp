@@ -1,72 +1,73 @@
 #include "terrainMesh.hpp"
 #include "vec3.hpp"
 #include "vec2.hpp"
+#include "taskScheduler.hpp"
 #include <glad/glad.h>
-#include <omp.h>
 
-void TerrainMesh::generate(float* hmapAltitude, float* hmapTerrain) {
+void TerrainMesh::setMaxHeight(float maxHeight) {
+    quantise(0.0f, maxHeight * HEIGHT_HEADROOM);
+}
+
+void TerrainMesh::generate(float* hmapAltitude, const float* hmapTerrain, const DirtyTiles* dirty) {
     altitude = hmapAltitude;
-    HeightMesh::generate(hmapTerrain);
+    HeightMesh::generate(hmapTerrain, dirty);
 }
 
 void TerrainMesh::sendGPU() {
-    // send mesh data to GPU
-    // generate buffers first time
-    if (!createdOnGPU) {
-        createdOnGPU = true;
-
-        // generate buffers
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &altitudeVBO);
-        glGenBuffers(1, &EBO);
-        
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(xWidth * zWidth * sizeof(float)));
+    const bool creating = !createdOnGPU;
+    HeightMesh::sendGPU();
 
-        glBindBuffer(GL_ARRAY_BUFFER, altitudeVBO);
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        
-        glBindVertexArray(0);
-
-        // send indices to GPU
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(uint32_t), indices, GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-        // send altitude to GPU
-        glBindBuffer(GL_ARRAY_BUFFER, altitudeVBO);
-        glBufferData(GL_ARRAY_BUFFER, xWidth * zWidth * sizeof(float), altitude, GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // altitude is read by vertex index from a storage buffer, only sent when first created or updated
+    if (creating) {
+        glGenBuffers(1, &altitudeBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, altitudeBuffer);
+        const std::vector<uint16_t> packed = packAltitude();
+        glBufferData(GL_SHADER_STORAGE_BUFFER, packed.size() * sizeof(uint16_t), packed.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        altitudeMax = heightMax;
+    }
+    // packed altitudes are meaningless once the height range changes
+    else if (altitudeMax != heightMax) {
+        updateAltitude();
     }
+};
 
-    // buffer orphaning
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, xWidth * zWidth * 4 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, xWidth * zWidth * sizeof(float), heights);
-    glBufferSubData(GL_ARRAY_BUFFER, xWidth * zWidth * sizeof(float), xWidth * zWidth * 3 * sizeof(float), normals);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+std::vector<uint16_t> TerrainMesh::packAltitude() const {
+    // altitude uses the same range and packing as the heights, padded to a whole number of uints
+    std::vector<uint16_t> packed((xWidth * zWidth + 1) / 2 * 2);
+    TaskScheduler::get().parallelFor(0, xWidth * zWidth, [&](int i) {
+        packed[i] = quantiseHeight(altitude[i]);
+    }, TaskScheduler::HIGH);
+    return packed;
+}
 
-    needSendGPU = false;
-};
+void TerrainMesh::bind() {
+    // everything the terrain shaders read besides the grid itself, for renderers drawing their own geometry over the heights
+    glUniform2f(HEIGHT_RANGE_LOCATION, heightMin, heightMax);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ALTITUDE_BINDING, altitudeBuffer);
+    bindHeights(HEIGHTS_BINDING);
+}
+
+void TerrainMesh::render() {
+    glUniform2f(HEIGHT_RANGE_LOCATION, heightMin, heightMax);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ALTITUDE_BINDING, altitudeBuffer);
+    HeightMesh::render();
+}
 
 void TerrainMesh::updateAltitude() {
-    glBindBuffer(GL_ARRAY_BUFFER, altitudeVBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, xWidth * zWidth * sizeof(float), altitude);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    const std::vector<uint16_t> packed = packAltitude();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, altitudeBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, packed.size() * sizeof(uint16_t), packed.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    altitudeMax = heightMax;
 }
 
 void TerrainMesh::clean() {
     if (createdOnGPU)
-        glDeleteBuffers(1, &altitudeVBO);
+        glDeleteBuffers(1, &altitudeBuffer);
     altitude = nullptr;
-    altitudeVBO = 0;
+    altitudeBuffer = 0;
+    altitudeMax = 0.0f;
     HeightMesh::clean();
 }
 
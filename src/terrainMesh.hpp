@@ -2,19 +2,30 @@
 #define TERRAIN_MESH_HPP_INCLUDED
 
 #include "heightMesh.hpp"
+#include <vector>
 
 class TerrainMesh : public HeightMesh
 {
 private:
 	float* altitude = nullptr;
-	unsigned int altitudeVBO = 0;
+	unsigned int altitudeBuffer = 0;
+	float altitudeMax = 0.0f; // range the altitude buffer was packed with
+
+	std::vector<uint16_t> packAltitude() const;
 
 public:
+	// heights and altitude are quantised up to this factor above the generated maximum, erosion may raise them past it
+	static constexpr float HEIGHT_HEADROOM = 1.25f;
+	static constexpr int HEIGHT_RANGE_LOCATION = 20;
+	static constexpr unsigned int ALTITUDE_BINDING = 10;
+
 	~TerrainMesh();
-	void generate(float*, float*);
+	void setMaxHeight(float);
+	void generate(float*, const float*, const DirtyTiles* dirty = nullptr);
 	void sendGPU();
+	void bind();
+	void render();
 	void clean();
-	inline unsigned int getVBO() const { return VBO; }
 	void updateAltitude();
 };
 
@@ -75,4 +75,6 @@ void InstancedTree::clean() {
 	glDeleteBuffers(1, &IBO);
 	glDeleteVertexArrays(1, &VAO);
 	instanceCount = 0;
+	VAO = 0;
+	IBO = 0;
 }
\ No newline at end of file
@@ -1,58 +1,64 @@
 #include "waterMesh.hpp"
-#include "vec3.hpp"
 #include <glad/glad.h>
-#include <omp.h>
 
-void WaterMesh::generate(uint32_t _terrainHeightVBO, float* hmapWater) {
-    terrainHeightVBO = _terrainHeightVBO;
-    HeightMesh::generate(hmapWater);
-}
+void WaterMesh::setWetTiles(const DirtyTiles& wet) {
+    // compact the wet flags in to a list of tiles to draw
+    std::vector<int> tiles;
+    for (int z = 0; z < wet.tilesZ; z++) {
+        for (int x = 0; x < wet.tilesX; x++) {
+            if (wet.tileDirty(x, z))
+                tiles.push_back(x | (z << 16));
+        }
+    }
 
-WaterMesh::~WaterMesh() {
-    clean();
+    std::lock_guard<std::mutex> lock(wetTilesMutex);
+    wetTiles.swap(tiles);
+    wetTilesChanged = true;
 }
 
 void WaterMesh::sendGPU() {
-    // send mesh data to GPU
-    // generate buffers first time
-    if (!createdOnGPU) {
-        createdOnGPU = true;
-
-        // generate buffers
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(xWidth * zWidth * sizeof(float)));
-
-        glBindBuffer(GL_ARRAY_BUFFER, terrainHeightVBO);
-        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glEnableVertexAttribArray(2);
-
-        glBindVertexArray(0);
+    HeightMesh::sendGPU();
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(uint32_t), indices, GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    }
+    std::lock_guard<std::mutex> lock(wetTilesMutex);
+    if (!wetTilesChanged)
+        return;
+    if (!wetTileBuffer)
+        glGenBuffers(1, &wetTileBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, wetTileBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(wetTiles.size(), 1) * sizeof(int), wetTiles.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    wetTileCount = (int)wetTiles.size();
+    wetTilesChanged = false;
+}
 
-    // buffer orphaning
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, xWidth * zWidth * 4 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, xWidth * zWidth * sizeof(float), heights);
-    glBufferSubData(GL_ARRAY_BUFFER, xWidth * zWidth * sizeof(float), xWidth * zWidth * 3 * sizeof(float), normals);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+void WaterMesh::render() {
+    if (wetTileCount == 0)
+        return;
 
-    needSendGPU = false;
-};
+    // each instance is one row of quads within a wet tile, drawn as a triangle strip
+    constexpr int TILE_SIZE = DirtyTiles::TILE_SIZE;
+    heightBuffer.bind(GL_SHADER_STORAGE_BUFFER, HEIGHTS_BINDING);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WET_TILES_BINDING, wetTileBuffer);
+    glUniform1i(TILE_SIZE_LOCATION, TILE_SIZE);
+    glUniform1i(SIZE_LOCATION, xWidth);
+    glBindVertexArray(VAO);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, (TILE_SIZE + 1) * 2, wetTileCount * TILE_SIZE);
+    glBindVertexArray(0);
+}
 
 void WaterMesh::clean() {
-    terrainHeightVBO = 0;
+    if (wetTileBuffer)
+        glDeleteBuffers(1, &wetTileBuffer);
+    wetTileBuffer = 0;
+    wetTileCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(wetTilesMutex);
+        wetTiles.clear();
+        wetTilesChanged = false;
+    }
     HeightMesh::clean();
 }
+
+WaterMesh::~WaterMesh() {
+    clean();
+}
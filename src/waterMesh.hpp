@@ -2,16 +2,36 @@
 #define WATER_MESH_HPP_INCLUDED
 
 #include "heightMesh.hpp"
+#include <vector>
+#include <mutex>
 
+// water surface heights, terrain heights are read from the terrain mesh's buffer when drawing
+// only tiles containing water are drawn, each as a patch of row strips
 class WaterMesh : public HeightMesh {
 private:
-	unsigned int terrainHeightVBO = 0;
+	// packed tile x and z of every wet tile, handed from the mesh generating thread to the render thread
+	std::vector<int> wetTiles;
+	std::mutex wetTilesMutex;
+	bool wetTilesChanged = false;
+
+	unsigned int wetTileBuffer = 0;
+	int wetTileCount = 0;
 
 public:
+	static constexpr unsigned int TERRAIN_HEIGHTS_BINDING = 9;
+	static constexpr int TERRAIN_HEIGHT_RANGE_LOCATION = 9; // range the quantised terrain heights decode to
+	static constexpr unsigned int WET_TILES_BINDING = 14;
+	static constexpr int TILE_SIZE_LOCATION = 10;
+	static constexpr int CELL_SCALE_LOCATION = 11; // terrain cells between water vertices
+	static constexpr int TERRAIN_SIZE_LOCATION = 12;
+	static constexpr int SIZE_LOCATION = 2;
+
 	~WaterMesh();
-	void generate(uint32_t, float*);
+	void setWetTiles(const DirtyTiles&);
 	void sendGPU();
+	void render();
 	void clean();
+	inline int getWetTileCount() const { return wetTileCount; }
 };
 
 #endif